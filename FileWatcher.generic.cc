@@ -0,0 +1,71 @@
+// Portable implementation, polling modification times
+#include "FileWatcher.hpp"
+#include <algorithm>
+#include <thread>
+
+class FileWatcherGeneric : public FileWatcher {
+public:
+  void watch(const std::vector<std::filesystem::path> &files) override {
+    _files.clear();
+    for (const auto &file : files) {
+      _files.push_back({.path = file, .stamp = _stamp(file)});
+    }
+  }
+
+  std::vector<std::filesystem::path>
+  wait(const std::chrono::milliseconds timeout) override {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::vector<std::filesystem::path> changed;
+
+    while (true) {
+      for (auto &file : _files) {
+        if (auto stamp = _stamp(file.path); stamp != file.stamp) {
+          file.stamp = stamp;
+          changed.push_back(file.path);
+        }
+      }
+
+      const auto now = std::chrono::steady_clock::now();
+      if (!changed.empty() || now >= deadline) {
+        return changed;
+      }
+
+      std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(
+          _interval, deadline - now));
+    }
+  }
+
+private:
+  // Modification time and size, none while the file is missing
+  struct Stamp {
+    std::filesystem::file_time_type time;
+    std::uintmax_t size = 0;
+    bool exists = false;
+
+    bool operator==(const Stamp &) const = default;
+  };
+
+  struct WatchedFile {
+    std::filesystem::path path;
+    Stamp stamp;
+  };
+
+  static constexpr std::chrono::milliseconds _interval{250};
+
+  std::vector<WatchedFile> _files;
+
+  static Stamp _stamp(const std::filesystem::path &file) {
+    std::error_code time_error;
+    std::error_code size_error;
+    const auto time = std::filesystem::last_write_time(file, time_error);
+    const auto size = std::filesystem::file_size(file, size_error);
+    if (time_error || size_error) {
+      return {};
+    }
+    return {.time = time, .size = size, .exists = true};
+  }
+};
+
+std::unique_ptr<FileWatcher> create_file_watcher() {
+  return std::make_unique<FileWatcherGeneric>();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+// Reports changes to a set of files. Editors often save by writing a new
+// file and renaming it over the old one, so files are followed by path, not
+// by what they were when the watch started. Implemented per platform, see
+// FileWatcher.*.cc.
+class FileWatcher {
+public:
+  virtual ~FileWatcher() = default;
+
+  // Replaces the watched files. Missing ones are reported once they appear.
+  virtual void watch(const std::vector<std::filesystem::path> &files) = 0;
+
+  // Waits up to `timeout` for a change, then returns the watched files that
+  // changed, as given to watch(). Empty when the timeout expired first.
+  virtual std::vector<std::filesystem::path>
+  wait(std::chrono::milliseconds timeout) = 0;
+};
+
+std::unique_ptr<FileWatcher> create_file_watcher();
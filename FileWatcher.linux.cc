@@ -0,0 +1,139 @@
+// Linux implementation, on inotify
+#include "FileWatcher.hpp"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <poll.h>
+#include <print>
+#include <string>
+#include <sys/inotify.h>
+#include <thread>
+#include <unistd.h>
+
+class FileWatcherLinux : public FileWatcher {
+public:
+  explicit FileWatcherLinux() {
+    _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_fd == -1) {
+      std::println(stderr, "Failed to watch files: {}", strerror(errno));
+    }
+  }
+
+  ~FileWatcherLinux() override {
+    if (_fd != -1) {
+      close(_fd);
+    }
+  }
+
+  FileWatcherLinux(const FileWatcherLinux &) = delete;
+  FileWatcherLinux &operator=(const FileWatcherLinux &) = delete;
+
+  // Directories are watched rather than the files themselves: a watch on a
+  // file follows its inode, which a save by rename leaves behind
+  void watch(const std::vector<std::filesystem::path> &files) override {
+    if (_fd == -1) {
+      return;
+    }
+
+    std::map<std::filesystem::path, int> directories;
+    _files.clear();
+
+    for (const auto &file : files) {
+      const auto absolute = std::filesystem::absolute(file).lexically_normal();
+      const auto directory = absolute.parent_path();
+
+      auto it = directories.find(directory);
+      if (it == directories.end()) {
+        if (auto kept = _directories.find(directory);
+            kept != _directories.end()) {
+          it = directories.insert(_directories.extract(kept)).position;
+        } else {
+          const int descriptor = inotify_add_watch(
+              _fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+          if (descriptor == -1) {
+            std::println(stderr, "Failed to watch {}: {}", directory.string(),
+                         strerror(errno));
+            continue;
+          }
+          it = directories.emplace(directory, descriptor).first;
+        }
+      }
+
+      _files.push_back({.descriptor = it->second,
+                        .name = absolute.filename().string(),
+                        .path = file});
+    }
+
+    // Whatever wasn't carried over is no longer needed
+    for (const auto &[directory, descriptor] : _directories) {
+      inotify_rm_watch(_fd, descriptor);
+    }
+    _directories = std::move(directories);
+  }
+
+  std::vector<std::filesystem::path>
+  wait(const std::chrono::milliseconds timeout) override {
+    std::vector<std::filesystem::path> changed;
+    if (_fd == -1) {
+      std::this_thread::sleep_for(timeout);
+      return changed;
+    }
+
+    pollfd events{.fd = _fd, .events = POLLIN, .revents = 0};
+    if (poll(&events, 1, static_cast<int>(timeout.count())) <= 0) {
+      return changed;
+    }
+
+    // A save comes as a burst of events (write, rename, attributes), which
+    // are reported together once they stop
+    do {
+      _read_events(changed);
+    } while (poll(&events, 1, _settle_time) > 0);
+
+    return changed;
+  }
+
+private:
+  struct WatchedFile {
+    int descriptor = -1;
+    std::string name;
+    std::filesystem::path path;
+  };
+
+  static constexpr int _settle_time = 30; // ms
+
+  int _fd = -1;
+  std::map<std::filesystem::path, int> _directories;
+  std::vector<WatchedFile> _files;
+
+  void _read_events(std::vector<std::filesystem::path> &changed) const {
+    alignas(inotify_event) char buffer[4096];
+
+    while (true) {
+      const ssize_t size = read(_fd, buffer, sizeof(buffer));
+      if (size <= 0) {
+        return;
+      }
+
+      for (ssize_t at = 0; at < size;) {
+        const auto *event =
+            reinterpret_cast<const inotify_event *>(buffer + at);
+        at += sizeof(inotify_event) + event->len;
+
+        for (const auto &file : _files) {
+          // Events were dropped, any file may have changed
+          const bool overflow = event->mask & IN_Q_OVERFLOW;
+          if ((overflow || (event->wd == file.descriptor && event->len > 0 &&
+                            file.name == event->name)) &&
+              std::ranges::find(changed, file.path) == changed.end()) {
+            changed.push_back(file.path);
+          }
+        }
+      }
+    }
+  }
+};
+
+std::unique_ptr<FileWatcher> create_file_watcher() {
+  return std::make_unique<FileWatcherLinux>();
+}
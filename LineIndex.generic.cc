@@ -0,0 +1,30 @@
+// Portable implementation of index_lines, for targets without a vectorised
+// one. memchr is usually vectorised by the C library already.
+#include "MmapReader.hpp"
+#include <cstring>
+
+void index_lines(const char *data, size_t size,
+                 std::vector<size_t> &line_starts) {
+  line_starts.clear();
+  if (size == 0) {
+    line_starts.push_back(0);
+    return;
+  }
+
+  // Rough guess of 40 bytes per line, saves most of the regrowth
+  line_starts.reserve(size / 40 + 2);
+  line_starts.push_back(0);
+
+  const char *position = data;
+  const char *end = data + size;
+
+  while (const void *newline = std::memchr(position, '\n', end - position)) {
+    position = static_cast<const char *>(newline) + 1;
+    line_starts.push_back(position - data);
+  }
+
+  // A trailing newline already pushed the `size` sentinel
+  if (line_starts.back() != size) {
+    line_starts.push_back(size);
+  }
+}
@@ -0,0 +1,86 @@
+// x86 implementation of index_lines: newlines are located 32 (AVX2) or 16
+// (SSE2) bytes at a time, the instruction set is picked once at runtime.
+// SSE2 is always there on x86-64, but not on every 32-bit CPU, which get
+// the byte loop instead.
+#include "MmapReader.hpp"
+#include <bit>
+#include <cstdint>
+#include <immintrin.h>
+
+namespace {
+
+void push_line_starts(uint32_t newline_mask, size_t chunk_offset,
+                      std::vector<size_t> &line_starts) {
+  while (newline_mask != 0) {
+    line_starts.push_back(chunk_offset + std::countr_zero(newline_mask) + 1);
+    newline_mask &= newline_mask - 1;
+  }
+}
+
+// Both return how far they got, the caller handles the remaining tail
+__attribute__((target("avx2"))) size_t
+index_lines_avx2(const char *data, size_t size,
+                 std::vector<size_t> &line_starts) {
+  const __m256i newline = _mm256_set1_epi8('\n');
+  size_t offset = 0;
+
+  for (; offset + 32 <= size; offset += 32) {
+    const __m256i chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + offset));
+    const auto mask = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline)));
+    push_line_starts(mask, offset, line_starts);
+  }
+
+  return offset;
+}
+
+__attribute__((target("sse2"))) size_t
+index_lines_sse2(const char *data, size_t size,
+                 std::vector<size_t> &line_starts) {
+  const __m128i newline = _mm_set1_epi8('\n');
+  size_t offset = 0;
+
+  for (; offset + 16 <= size; offset += 16) {
+    const __m128i chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offset));
+    const auto mask = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)));
+    push_line_starts(mask, offset, line_starts);
+  }
+
+  return offset;
+}
+
+} // namespace
+
+void index_lines(const char *data, size_t size,
+                 std::vector<size_t> &line_starts) {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  static const bool has_sse2 = __builtin_cpu_supports("sse2");
+
+  line_starts.clear();
+  if (size == 0) {
+    line_starts.push_back(0);
+    return;
+  }
+
+  // Rough guess of 40 bytes per line, saves most of the regrowth
+  line_starts.reserve(size / 40 + 2);
+  line_starts.push_back(0);
+
+  size_t offset = has_avx2   ? index_lines_avx2(data, size, line_starts)
+                  : has_sse2 ? index_lines_sse2(data, size, line_starts)
+                             : 0;
+
+  for (; offset < size; offset++) {
+    if (data[offset] == '\n') {
+      line_starts.push_back(offset + 1);
+    }
+  }
+
+  // A trailing newline already pushed the `size` sentinel
+  if (line_starts.back() != size) {
+    line_starts.push_back(size);
+  }
+}
@@ -1,10 +1,20 @@
 #pragma once
 
-#include <algorithm>
 #include <cstddef>
 #include <iterator>
 #include <memory>
 #include <ranges>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Fills `line_starts` with the offset of every line in `data`, followed by a
+// final `size` sentinel, so line `i` spans [line_starts[i],
+// line_starts[i + 1]) including its line terminator. A trailing newline
+// doesn't start an extra empty line. Implemented per architecture, see
+// LineIndex.*.cc.
+void index_lines(const char *data, size_t size,
+                 std::vector<size_t> &line_starts);
 
 class MmapReader {
 public:
@@ -15,6 +25,14 @@ public:
   virtual size_t get_size() const = 0;
   virtual bool is_open() const = 0;
 
+  // Hints that [offset, offset + length) won't be read again soon, so its
+  // pages can be dropped from memory. Reading it afterwards is still valid.
+  virtual void release(size_t offset, size_t length) const {
+    (void)offset;
+    (void)length;
+  }
+
+  // Walks the precomputed line index, no byte is scanned while iterating
   class LineIterator {
   public:
     using iterator_category = std::input_iterator_tag;
@@ -25,20 +43,29 @@ public:
 
     LineIterator() = default;
 
-    LineIterator(const char *ptr, const char *end)
-        : _current_pos(ptr), _end_pos(end) {}
+    LineIterator(const char *data, const size_t *line_start)
+        : _data(data), _line_start(line_start) {}
 
-    // dereference operator: returns a string_view of the current line
+    // dereference operator: returns a string_view of the current line,
+    // without its `\n` or `\r\n` terminator
     reference operator*() const {
-      const char *newline_pos = std::find(_current_pos, _end_pos, '\n');
-      _cached_view = std::string_view(_current_pos, newline_pos - _current_pos);
+      const char *begin = _data + _line_start[0];
+      const char *end = _data + _line_start[1];
+
+      if (end != begin && end[-1] == '\n') {
+        --end;
+        if (end != begin && end[-1] == '\r') {
+          --end;
+        }
+      }
+
+      _cached_view = std::string_view(begin, end - begin);
       return _cached_view;
     }
 
     // pre-increment operator: moves to the next line
     LineIterator &operator++() {
-      const char *newline_pos = std::find(_current_pos, _end_pos, '\n');
-      _current_pos = (newline_pos == _end_pos) ? _end_pos : newline_pos + 1;
+      ++_line_start;
       return *this;
     }
 
@@ -49,26 +76,49 @@ public:
     }
 
     bool operator==(const LineIterator &other) const {
-      return _current_pos == other._current_pos;
+      return _line_start == other._line_start;
     }
 
     bool operator!=(const LineIterator &other) const {
-      return _current_pos != other._current_pos;
+      return _line_start != other._line_start;
     }
 
   private:
-    const char *_current_pos;
-    const char *_end_pos;
+    const char *_data = nullptr;
+    const size_t *_line_start = nullptr;
     mutable std::string_view _cached_view;
   };
 
+  // Built on first use, in a single pass over the mapping
+  const std::vector<size_t> &line_starts() const {
+    if (!_line_index_built) {
+      index_lines(get_data(), get_size(), _line_starts);
+      _line_index_built = true;
+    }
+
+    return _line_starts;
+  }
+
+  size_t line_count() const { return line_starts().size() - 1; }
+
+  // Lines [first, last), as a range of string_views
+  auto lines(size_t first, size_t last) const {
+    return std::ranges::subrange(
+        LineIterator(get_data(), line_starts().data() + first),
+        LineIterator(get_data(), line_starts().data() + last));
+  }
+
   LineIterator begin() const {
-    return LineIterator(get_data(), get_data() + get_size());
+    return LineIterator(get_data(), line_starts().data());
   }
 
   LineIterator end() const {
-    return LineIterator(get_data() + get_size(), get_data() + get_size());
+    return LineIterator(get_data(), line_starts().data() + line_count());
   }
+
+private:
+  mutable std::vector<size_t> _line_starts;
+  mutable bool _line_index_built = false;
 };
 
 static_assert(std::ranges::range<MmapReader>);
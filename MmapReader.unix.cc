@@ -1,5 +1,6 @@
 // UNIX implementation
 #include "MmapReader.hpp"
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <fcntl.h>
@@ -7,6 +8,7 @@
 #include <print>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 class MmapReaderUnix : public MmapReader {
 public:
@@ -93,6 +95,19 @@ public:
   size_t get_size() const override { return _file_size; }
   bool is_open() const override { return _is_open; };
 
+  void release(size_t offset, size_t length) const override {
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+
+    // madvise wants page aligned ranges, only whole pages inside are dropped
+    const size_t begin = (offset + page_size - 1) / page_size * page_size;
+    const size_t end =
+        std::min(offset + length, _file_size) / page_size * page_size;
+
+    if (_mapped_data != nullptr && begin < end) {
+      madvise(_mapped_data + begin, end - begin, MADV_DONTNEED);
+    }
+  }
+
 private:
   int _fd = -1;
   char *_mapped_data = nullptr;
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+
+// A temporary file response bodies are written to as they arrive, then
+// mapped to be read back, so they stay out of the heap whatever their size.
+// Nothing is left on disk once it is destroyed. Implemented per platform,
+// see SpoolFile.*.cc.
+class SpoolFile {
+public:
+  virtual ~SpoolFile() = default;
+
+  virtual bool is_open() const = 0;
+
+  // Appends `bytes`; only before map()
+  virtual bool write(std::string_view bytes) = 0;
+
+  // Everything written, mapped read-only. Empty when nothing was written
+  // or it couldn't be mapped.
+  virtual std::string_view map() = 0;
+};
+
+std::unique_ptr<SpoolFile> create_spool_file();
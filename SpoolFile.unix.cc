@@ -0,0 +1,86 @@
+// UNIX implementation
+#include "SpoolFile.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <print>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+class SpoolFileUnix : public SpoolFile {
+public:
+  explicit SpoolFileUnix() {
+    const char *directory = std::getenv("TMPDIR");
+    std::string path = directory && *directory ? directory : "/tmp";
+    path += "/agatetepe-spool-XXXXXX";
+
+    _fd = mkstemp(path.data());
+    if (_fd == -1) {
+      std::println(stderr, "Failed to create a spool file in {}: {}",
+                   path.substr(0, path.rfind('/')), strerror(errno));
+      return;
+    }
+
+    // Anonymous from now on, the data goes away with the descriptor
+    unlink(path.c_str());
+  }
+
+  ~SpoolFileUnix() override {
+    if (_mapped_data != nullptr) {
+      munmap(_mapped_data, _size);
+    }
+    if (_fd != -1) {
+      close(_fd);
+    }
+  }
+
+  SpoolFileUnix(const SpoolFileUnix &) = delete;
+  SpoolFileUnix &operator=(const SpoolFileUnix &) = delete;
+
+  bool is_open() const override { return _fd != -1; }
+
+  bool write(std::string_view bytes) override {
+    if (_fd == -1 || _mapped_data != nullptr) {
+      return false;
+    }
+
+    while (!bytes.empty()) {
+      const ssize_t written = ::write(_fd, bytes.data(), bytes.size());
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      bytes.remove_prefix(static_cast<size_t>(written));
+      _size += static_cast<size_t>(written);
+    }
+
+    return true;
+  }
+
+  std::string_view map() override {
+    if (_mapped_data == nullptr && _fd != -1 && _size > 0) {
+      void *mapped = mmap(nullptr, _size, PROT_READ, MAP_SHARED, _fd, 0);
+      if (mapped == MAP_FAILED) {
+        std::println(stderr, "Failed to map the spool file: {}",
+                     strerror(errno));
+        return {};
+      }
+      _mapped_data = static_cast<char *>(mapped);
+    }
+
+    return _mapped_data ? std::string_view(_mapped_data, _size)
+                        : std::string_view();
+  }
+
+private:
+  int _fd = -1;
+  char *_mapped_data = nullptr;
+  size_t _size = 0;
+};
+
+std::unique_ptr<SpoolFile> create_spool_file() {
+  return std::make_unique<SpoolFileUnix>();
+}
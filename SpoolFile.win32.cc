@@ -0,0 +1,98 @@
+#define WIN32_LEAN_AND_MEAN
+#include "SpoolFile.hpp"
+#include <algorithm>
+#include <print>
+#include <windows.h>
+
+class SpoolFileWin32 : public SpoolFile {
+public:
+  explicit SpoolFileWin32() {
+    char directory[MAX_PATH + 1];
+    char path[MAX_PATH];
+    if (GetTempPathA(sizeof(directory), directory) == 0 ||
+        GetTempFileNameA(directory, "agt", 0, path) == 0) {
+      std::println(stderr, "Failed to create a spool file");
+      return;
+    }
+
+    // Deleted by the system once the handle is closed
+    file_handle = CreateFileA(
+        path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+      std::println(stderr, "Failed to create a spool file: {}", path);
+      DeleteFileA(path);
+    }
+  }
+
+  ~SpoolFileWin32() override {
+    if (_mapped_data != NULL) {
+      UnmapViewOfFile(_mapped_data);
+    }
+    if (map_handle != NULL) {
+      CloseHandle(map_handle);
+    }
+    if (file_handle != INVALID_HANDLE_VALUE) {
+      CloseHandle(file_handle);
+    }
+  }
+
+  SpoolFileWin32(const SpoolFileWin32 &) = delete;
+  SpoolFileWin32 &operator=(const SpoolFileWin32 &) = delete;
+
+  bool is_open() const override {
+    return file_handle != INVALID_HANDLE_VALUE;
+  }
+
+  bool write(std::string_view bytes) override {
+    if (file_handle == INVALID_HANDLE_VALUE || _mapped_data != NULL) {
+      return false;
+    }
+
+    while (!bytes.empty()) {
+      DWORD written = 0;
+      if (!WriteFile(file_handle, bytes.data(),
+                     static_cast<DWORD>(std::min<size_t>(bytes.size(),
+                                                         MAXDWORD)),
+                     &written, NULL) ||
+          written == 0) {
+        return false;
+      }
+      bytes.remove_prefix(written);
+      _size += written;
+    }
+
+    return true;
+  }
+
+  std::string_view map() override {
+    if (_mapped_data == NULL && file_handle != INVALID_HANDLE_VALUE &&
+        _size > 0) {
+      map_handle =
+          CreateFileMapping(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (map_handle == NULL) {
+        std::println(stderr, "Failed to map the spool file");
+        return {};
+      }
+      _mapped_data = static_cast<char *>(
+          MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, _size));
+      if (_mapped_data == NULL) {
+        std::println(stderr, "Failed to map the spool file");
+        return {};
+      }
+    }
+
+    return _mapped_data != NULL ? std::string_view(_mapped_data, _size)
+                                : std::string_view();
+  }
+
+private:
+  HANDLE file_handle = INVALID_HANDLE_VALUE;
+  HANDLE map_handle = NULL;
+  char *_mapped_data = NULL;
+  size_t _size = 0;
+};
+
+std::unique_ptr<SpoolFile> create_spool_file() {
+  return std::make_unique<SpoolFileWin32>();
+}
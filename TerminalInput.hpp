@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <memory>
 
 class TerminalInput {
@@ -7,6 +8,10 @@ public:
   virtual ~TerminalInput() = default;
 
   virtual int get_key() const = 0;
+
+  // Whether get_key would return within `timeout`, so a caller can do other
+  // work between key presses
+  virtual bool wait_for_key(std::chrono::milliseconds timeout) const = 0;
 };
 
 std::unique_ptr<TerminalInput> create_terminal_input();
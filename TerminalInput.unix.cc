@@ -1,6 +1,7 @@
 #include "TerminalInput.hpp"
 #include <fcntl.h>
 #include <memory>
+#include <poll.h>
 #include <termios.h>
 #include <thread>
 
@@ -63,8 +64,13 @@ public:
       return 0; // Error or EOF
     }
 
-    // Check if it's an escape sequence (like arrow keys)
+    // Check if it's an escape sequence (like arrow keys). Escape on its own
+    // isn't followed by anything
     if (ch == '\033') {
+      if (!wait_for_key(m_sequence_timeout)) {
+        return ch;
+      }
+
       char seq[2];
       if (read(m_tty_fd, &seq[0], 1) <= 0)
         return ch;
@@ -88,7 +94,20 @@ public:
     return ch; // Regular character
   }
 
+  bool wait_for_key(std::chrono::milliseconds timeout) const override {
+    if (!m_is_interactive) {
+      // get_key returns right away
+      return true;
+    }
+
+    pollfd events{.fd = m_tty_fd, .events = POLLIN, .revents = 0};
+    return poll(&events, 1, static_cast<int>(timeout.count())) > 0;
+  }
+
 private:
+  // The bytes of a sequence arrive together, well within this
+  static constexpr std::chrono::milliseconds m_sequence_timeout{25};
+
   struct termios m_old_tio, m_new_tio;
   int m_tty_fd = -1;
   bool m_is_interactive = false;
@@ -1,5 +1,6 @@
 #define WIN32_LEAN_AND_MEAN
 #include "TerminalInput.hpp"
+#include <chrono>
 #include <conio.h>
 #include <fcntl.h> // For _O_TEXT
 #include <io.h>    // For _isatty
@@ -116,6 +117,36 @@ public:
     return get_key(); // Recursive call to wait for a valid key
   }
 
+  bool wait_for_key(std::chrono::milliseconds timeout) const override {
+    if (!m_is_interactive) {
+      // get_key returns right away
+      return true;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true) {
+      const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      const DWORD wait =
+          left.count() > 0 ? static_cast<DWORD>(left.count()) : 0;
+      if (WaitForSingleObject(hStdin, wait) != WAIT_OBJECT_0) {
+        return false;
+      }
+
+      // Focus, mouse and key release events signal the handle too, they are
+      // dropped so they don't count as a key
+      INPUT_RECORD record;
+      DWORD count = 0;
+      if (!PeekConsoleInput(hStdin, &record, 1, &count) || count == 0) {
+        return false;
+      }
+      if (record.EventType == KEY_EVENT && record.Event.KeyEvent.bKeyDown) {
+        return true;
+      }
+      ReadConsoleInput(hStdin, &record, 1, &count);
+    }
+  }
+
 private:
   HANDLE hStdin;
   DWORD fdwMode, fdwOldMode;
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+// The terminal the menu is drawn on: its size, and raw writes to it.
+// Implemented per platform, see TerminalScreen.*.cc.
+class TerminalScreen {
+public:
+  struct Size {
+    size_t rows = 24;
+    size_t columns = 80;
+
+    bool operator==(const Size &) const = default;
+  };
+
+  virtual ~TerminalScreen() = default;
+
+  // Asked on every call, so it's right as soon as the terminal is resized.
+  // The default size when there's no terminal to ask.
+  virtual Size size() const = 0;
+
+  // Whether the terminal was resized since the last call
+  virtual bool resized() = 0;
+
+  // Writes all of `bytes` to standard output, around stdio's buffer
+  virtual void write(std::string_view bytes) = 0;
+};
+
+std::unique_ptr<TerminalScreen> create_terminal_screen();
@@ -0,0 +1,73 @@
+// UNIX implementation
+#include "TerminalScreen.hpp"
+#include <cerrno>
+#include <csignal>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace {
+
+volatile std::sig_atomic_t window_changed = 0;
+
+void on_window_change(int) { window_changed = 1; }
+
+} // namespace
+
+class TerminalScreenUnix : public TerminalScreen {
+public:
+  explicit TerminalScreenUnix() {
+    // SA_RESTART keeps reads and writes elsewhere going, a key wait still
+    // returns early so the menu is redrawn right away
+    struct sigaction action = {};
+    action.sa_handler = on_window_change;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    m_installed = sigaction(SIGWINCH, &action, &m_old_action) == 0;
+  }
+
+  ~TerminalScreenUnix() override {
+    if (m_installed) {
+      sigaction(SIGWINCH, &m_old_action, nullptr);
+    }
+  }
+
+  TerminalScreenUnix(const TerminalScreenUnix &) = delete;
+  TerminalScreenUnix &operator=(const TerminalScreenUnix &) = delete;
+
+  Size size() const override {
+    winsize window = {};
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == -1 || window.ws_row == 0 ||
+        window.ws_col == 0) {
+      return {};
+    }
+    return {.rows = window.ws_row, .columns = window.ws_col};
+  }
+
+  bool resized() override {
+    const bool changed = window_changed != 0;
+    window_changed = 0;
+    return changed;
+  }
+
+  void write(std::string_view bytes) override {
+    while (!bytes.empty()) {
+      const ssize_t written =
+          ::write(STDOUT_FILENO, bytes.data(), bytes.size());
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+      bytes.remove_prefix(static_cast<size_t>(written));
+    }
+  }
+
+private:
+  struct sigaction m_old_action = {};
+  bool m_installed = false;
+};
+
+std::unique_ptr<TerminalScreen> create_terminal_screen() {
+  return std::make_unique<TerminalScreenUnix>();
+}
@@ -0,0 +1,67 @@
+#define WIN32_LEAN_AND_MEAN
+#include "TerminalScreen.hpp"
+#include <windows.h>
+
+class TerminalScreenWin32 : public TerminalScreen {
+public:
+  explicit TerminalScreenWin32() {
+    hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+
+    // The menu is drawn with ANSI escape sequences, which consoles only
+    // interpret in virtual terminal mode
+    if (GetConsoleMode(hStdout, &fdwOldMode)) {
+      m_is_console = true;
+      SetConsoleMode(hStdout,
+                     fdwOldMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+    }
+
+    m_size = size();
+  }
+
+  ~TerminalScreenWin32() override {
+    if (m_is_console) {
+      SetConsoleMode(hStdout, fdwOldMode);
+    }
+  }
+
+  Size size() const override {
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (!GetConsoleScreenBufferInfo(hStdout, &info)) {
+      return {};
+    }
+    return {.rows = static_cast<size_t>(info.srWindow.Bottom -
+                                        info.srWindow.Top + 1),
+            .columns = static_cast<size_t>(info.srWindow.Right -
+                                           info.srWindow.Left + 1)};
+  }
+
+  // Consoles don't signal resizes, the size is compared instead
+  bool resized() override {
+    const Size current = size();
+    const bool changed = current != m_size;
+    m_size = current;
+    return changed;
+  }
+
+  void write(std::string_view bytes) override {
+    while (!bytes.empty()) {
+      DWORD written = 0;
+      if (!WriteFile(hStdout, bytes.data(), static_cast<DWORD>(bytes.size()),
+                     &written, NULL) ||
+          written == 0) {
+        return;
+      }
+      bytes.remove_prefix(written);
+    }
+  }
+
+private:
+  HANDLE hStdout;
+  DWORD fdwOldMode = 0;
+  bool m_is_console = false;
+  Size m_size;
+};
+
+std::unique_ptr<TerminalScreen> create_terminal_screen() {
+  return std::make_unique<TerminalScreenWin32>();
+}
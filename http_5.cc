@@ -1,36 +1,66 @@
 // TODO(stanley): use free functions instead of classes
+#include "FileWatcher.hpp"
 #include "MmapReader.hpp"
+#include "SpoolFile.hpp"
 #include "TerminalInput.hpp"
+#include "TerminalScreen.hpp"
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
 #include <chrono>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cerrno>
 #include <cstring>
+#include <curl/multi.h>
 #include <ctime>
 #include <curl/curl.h>
 #include <curl/easy.h>
 #include <expected>
+#include <filesystem>
 #include <format>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <numeric>
 #include <optional>
 #include <print>
 #include <random>
 #include <ranges>
+#include <span>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <sys/wait.h>
 #include <termios.h>
+#include <thread>
+#include <tuple>
 #include <type_traits>
+#include <unordered_map>
 #include <unistd.h>
+#include <utility>
+#include <variant>
 #include <vector>
-
-enum class e_agatetepe_error { unknown, parse_error, curl_error };
+#include <zlib.h>
+
+enum class e_agatetepe_error {
+  unknown,
+  parse_error,
+  curl_error,
+  io_error,
+  cancelled
+};
 
 struct AgatetepeError {
   e_agatetepe_error code = e_agatetepe_error::unknown;
@@ -44,6 +74,104 @@ static constexpr size_t string_length(const char *str) {
   return count;
 }
 
+// ASCII only, which is all HTTP field names need
+static bool equals_ignoring_case(const std::string_view a,
+                                 const std::string_view b) {
+  constexpr auto lower = [](const char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c | 0x20) : c;
+  };
+  return std::ranges::equal(a, b, {}, lower, lower);
+}
+
+// Per-user cache directory: $XDG_CACHE_HOME/agatetepe, else
+// ~/.cache/agatetepe, else %LOCALAPPDATA%\agatetepe
+static std::filesystem::path cache_directory() {
+  if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+    return std::filesystem::path(xdg) / "agatetepe";
+  }
+  if (const char *home = std::getenv("HOME"); home && *home) {
+    return std::filesystem::path(home) / ".cache" / "agatetepe";
+  }
+  if (const char *local = std::getenv("LOCALAPPDATA"); local && *local) {
+    return std::filesystem::path(local) / "agatetepe";
+  }
+  return std::filesystem::temp_directory_path() / "agatetepe";
+}
+
+// 64-bit FNV-1a, for naming cache files. Not cryptographic, and not fast
+// either, but network bound work doesn't notice.
+class Fnv1a {
+public:
+  void update(const std::string_view bytes) {
+    for (const unsigned char byte : bytes) {
+      _value = (_value ^ byte) * 0x100000001b3ULL;
+    }
+  }
+
+  uint64_t value() const { return _value; }
+
+private:
+  uint64_t _value = 0xcbf29ce484222325ULL;
+};
+
+// xoshiro256** (https://prng.di.unimi.it), seeded through splitmix64. Not
+// cryptographic, but fast, and good enough for the fake data below.
+class FastRandom {
+public:
+  using result_type = uint64_t;
+
+  explicit FastRandom(uint64_t seed) {
+    for (auto &word : _state) {
+      seed += 0x9E3779B97F4A7C15;
+      uint64_t z = seed;
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+      word = z ^ (z >> 31);
+    }
+  }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return UINT64_MAX; }
+
+  result_type operator()() {
+    const uint64_t result = std::rotl(_state[1] * 5, 7) * 9;
+    const uint64_t t = _state[1] << 17;
+
+    _state[2] ^= _state[0];
+    _state[3] ^= _state[1];
+    _state[1] ^= _state[2];
+    _state[0] ^= _state[3];
+    _state[2] ^= t;
+    _state[3] = std::rotl(_state[3], 45);
+
+    return result;
+  }
+
+private:
+  std::array<uint64_t, 4> _state;
+};
+
+// A `{{$...}}` expression resolved once, when its template is compiled: the
+// generator is picked and its parameters parsed, rendering only generates.
+struct DynamicVariable {
+  using Generator = void (*)(const DynamicVariable &, std::string &out);
+
+  // Unknown variables have none and render as nothing
+  Generator generate = nullptr;
+  // Range of random.integer, or length of the random strings
+  int64_t from = 0;
+  int64_t to = 0;
+  // Range of random.float
+  double real_from = 0;
+  double real_to = 0;
+
+  void append_to(std::string &out) const {
+    if (generate) {
+      generate(*this, out);
+    }
+  }
+};
+
 // Dynamic Variable resolver based on Rider's dynamic variables behaviour:
 // https://www.jetbrains.com/help/rider/HTTP-Client-variables.html#dynamic-variables
 // which in turn is based on Java's Faker:
@@ -51,7 +179,8 @@ static constexpr size_t string_length(const char *str) {
 // TODO(stanley): put into a namespace with free functions
 class DynamicVariableResolver {
 public:
-  static std::string resolve(const std::string_view input) {
+  // `input` is the whole expression, `$random.integer(1, 9)`
+  static DynamicVariable compile(const std::string_view input) {
     static constexpr auto paren_length = string_length("(");
     // remove $
     std::string_view var_name = input.substr(1, input.length());
@@ -60,849 +189,7055 @@ public:
     auto param_end_pos = var_name.find(')');
 
     if (param_end_pos == std::string_view::npos && has_params)
-      return "";
+      return {};
     std::string_view prefix =
         var_name.substr(0, has_params ? param_start_pos : var_name.size());
 
     std::string_view params =
         has_params ? var_name.substr(param_start_pos + paren_length,
-                                     param_end_pos - paren_length)
+                                     param_end_pos - param_start_pos -
+                                         paren_length)
                    : "";
 
-    return _generate_variable(prefix, params);
+    for (const auto &[name, generator, defaults] : _generators()) {
+      if (name == prefix) {
+        DynamicVariable variable = defaults;
+        variable.generate = generator;
+        _parse_params(params, variable);
+        return variable;
+      }
+    }
+
+    return {}; // Unknown variable type
   }
 
+  // Makes every thread's sequence reproducible, must be called before
+  // anything is generated
+  static void seed(const uint64_t seed) { _seed() = seed; }
+
 private:
-  static std::string _generate_variable(const std::string_view variable_type,
-                                        const std::string_view params) {
-    // TODO(stanley): may use a map
-    if (variable_type == "uuid" || variable_type == "random.uuid") {
-      return _generate_uuid();
-    } else if (variable_type == "timestamp") {
-      return _generate_timestamp();
-    } else if (variable_type == "isoTimestamp") {
-      return _generate_iso_timestamp();
-    } else if (variable_type == "randomInt" ||
-               variable_type == "random.integer") {
-      return _generate_random_int(params);
-    } else if (variable_type == "random.float") {
-      return _generate_random_float(params);
-    } else if (variable_type == "random.alphabetic") {
-      return _generate_random_alphabetic(params);
-    } else if (variable_type == "random.alphanumeric") {
-      return _generate_random_alphanumeric(params);
-    } else if (variable_type == "random.hexadecimal") {
-      return _generate_random_hexadecimal(params);
-    } else if (variable_type == "random.email") {
-      return _generate_random_email();
-    }
-
-    return ""; // Unknown variable type
-  }
-
-  static std::string _generate_uuid() {
-    // Generate a UUID v4
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 15);
-
-    // Generate 32 hex digits
-    std::string uuid;
-    uuid.reserve(36); // 32 hex digits + 4 hyphens
-
-    for (int i = 0; i < 32; i++) {
-      if (i == 8 || i == 12 || i == 16 || i == 20) {
-        uuid += '-';
-      }
-
-      if (i == 12) {
-        uuid += '4'; // Version 4
-      } else if (i == 16) {
-        // Variant bits: 10xx
-        uuid += static_cast<char>('8' + (dis(gen) % 4));
-      } else {
-        int value = dis(gen);
-        uuid +=
-            static_cast<char>(value < 10 ? '0' + value : 'a' + (value - 10));
+  struct GeneratorEntry {
+    std::string_view name;
+    DynamicVariable::Generator generator;
+    DynamicVariable defaults;
+  };
+
+  static constexpr DynamicVariable _length(int64_t length) {
+    return {.generate = nullptr,
+            .from = length,
+            .to = 0,
+            .real_from = 0,
+            .real_to = 0};
+  }
+
+  static constexpr DynamicVariable _range(int64_t from, int64_t to) {
+    return {.generate = nullptr,
+            .from = from,
+            .to = to,
+            .real_from = static_cast<double>(from),
+            .real_to = static_cast<double>(to)};
+  }
+
+  // Looked up once per template slot, never while rendering
+  static const std::array<GeneratorEntry, 11> &_generators() {
+    static constexpr std::array generators = {
+        GeneratorEntry{"uuid", _generate_uuid, {}},
+        GeneratorEntry{"random.uuid", _generate_uuid, {}},
+        GeneratorEntry{"timestamp", _generate_timestamp, {}},
+        GeneratorEntry{"isoTimestamp", _generate_iso_timestamp, {}},
+        GeneratorEntry{"randomInt", _generate_random_int, _range(0, 1000)},
+        GeneratorEntry{"random.integer", _generate_random_int, _range(0, 1000)},
+        GeneratorEntry{"random.float", _generate_random_float, _range(0, 1000)},
+        GeneratorEntry{"random.alphabetic", _generate_random_alphabetic,
+                       _length(10)},
+        GeneratorEntry{"random.alphanumeric", _generate_random_alphanumeric,
+                       _length(10)},
+        GeneratorEntry{"random.hexadecimal", _generate_random_hexadecimal,
+                       _length(10)},
+        GeneratorEntry{"random.email", _generate_random_email, {}},
+    };
+    return generators;
+  }
+
+  static constexpr std::string_view _hex_digits = "0123456789abcdef";
+  static constexpr std::string_view _alphabetic =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  static constexpr std::string_view _alphanumeric =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+
+  // `from, to` or `length`; missing or malformed numbers keep the default
+  static void _parse_params(std::string_view params,
+                            DynamicVariable &variable) {
+    const size_t comma = params.find(',');
+    const auto first = params.substr(0, comma);
+    const auto second = comma == std::string_view::npos
+                            ? std::string_view()
+                            : params.substr(comma + 1);
+
+    _parse_number(first, variable.from);
+    _parse_number(second, variable.to);
+    _parse_number(first, variable.real_from);
+    _parse_number(second, variable.real_to);
+  }
+
+  static void _parse_number(std::string_view text, auto &number) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+      text.remove_prefix(1);
+    }
+    std::from_chars(text.data(), text.data() + text.size(), number);
+  }
+
+  static uint64_t &_seed() {
+    static uint64_t seed = (static_cast<uint64_t>(std::random_device{}()) << 32) |
+                           std::random_device{}();
+    return seed;
+  }
+
+  // One generator per thread, each on its own stream of the seed
+  static FastRandom &_random() {
+    static std::atomic<uint64_t> streams = 0;
+    thread_local FastRandom random(_seed() + 0xD1B54A32D192ED03 * streams++);
+    return random;
+  }
+
+  // Appends `length` characters of `charset` (at most 64 of them), taking
+  // six bits at a time from every random word
+  static void _append_random(std::string &out, int64_t length,
+                             const std::string_view charset) {
+    if (length <= 0) {
+      return;
+    }
+
+    const size_t start = out.size();
+    out.resize(start + length);
+    char *next = out.data() + start;
+    char *const end = out.data() + out.size();
+    auto &random = _random();
+
+    while (next != end) {
+      uint64_t word = random();
+      for (int i = 0; i < 10 && next != end; i++, word >>= 6) {
+        // Rejecting what falls outside the charset keeps it uniform
+        if (const auto value = word & 63; value < charset.size()) {
+          *next++ = charset[value];
+        }
+      }
+    }
+  }
+
+  static void _generate_uuid(const DynamicVariable &, std::string &out) {
+    // Generate a UUID v4 out of 128 random bits
+    auto &random = _random();
+    const std::array<uint64_t, 2> words = {random(), random()};
+
+    char uuid[36];
+    for (int i = 0, digit = 0; i < 36; i++) {
+      if (i == 8 || i == 13 || i == 18 || i == 23) {
+        uuid[i] = '-';
+        continue;
+      }
+
+      unsigned value = (words[digit / 16] >> (4 * (digit % 16))) & 0xF;
+      if (digit == 12) {
+        value = 4; // Version 4
+      } else if (digit == 16) {
+        value = 8 | (value & 3); // Variant bits: 10xx
       }
+      uuid[i] = _hex_digits[value];
+      digit++;
     }
 
-    return uuid;
+    out.append(uuid, sizeof(uuid));
   }
 
-  static std::string _generate_timestamp() {
+  static void _generate_timestamp(const DynamicVariable &, std::string &out) {
     auto now = std::chrono::system_clock::now();
     auto timestamp =
         std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch())
             .count();
-    return std::to_string(timestamp);
+    _append_number(out, timestamp);
   }
 
-  static std::string _generate_iso_timestamp() {
+  static void _generate_iso_timestamp(const DynamicVariable &,
+                                      std::string &out) {
     auto now = std::chrono::system_clock::now();
     auto time_t = std::chrono::system_clock::to_time_t(now);
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
                   now.time_since_epoch()) %
               1000;
 
-    std::ostringstream oss;
-    oss << std::put_time(std::gmtime(&time_t), "%Y-%m-%dT%H:%M:%S");
-    oss << '.' << std::setfill('0') << std::setw(3) << ms.count() << 'Z';
+    char buffer[32];
+    const size_t length = std::strftime(buffer, sizeof(buffer),
+                                        "%Y-%m-%dT%H:%M:%S", std::gmtime(&time_t));
+    out.append(buffer, length);
+    out += std::format(".{:03}Z", ms.count());
+  }
+
+  static void _generate_random_int(const DynamicVariable &variable,
+                                   std::string &out) {
+    // `to` is exclusive
+    if (variable.to - 1 <= variable.from) {
+      _append_number(out, variable.from);
+      return;
+    }
 
-    return oss.str();
+    std::uniform_int_distribution<int64_t> dis(variable.from, variable.to - 1);
+    _append_number(out, dis(_random()));
   }
 
-  static std::string _generate_random_int(const std::string_view params) {
-    std::random_device rd;
-    // TODO(stanley): maybe should be static and reuse
-    std::mt19937 gen(rd());
+  static void _generate_random_float(const DynamicVariable &variable,
+                                     std::string &out) {
+    std::uniform_real_distribution<> dis(
+        variable.real_from, std::max(variable.real_from, variable.real_to));
 
-    int from = 0, to = 1000;
+    out += std::format("{:.6f}", dis(_random()));
+  }
 
-    if (!params.empty()) {
-      std::stringstream ss((std::string(params)));
-      char comma;
-      ss >> from >> comma >> to;
-    }
+  static void _generate_random_alphabetic(const DynamicVariable &variable,
+                                          std::string &out) {
+    _append_random(out, variable.from, _alphabetic);
+  }
 
-    std::uniform_int_distribution<> dis(from, to - 1);
-    return std::to_string(dis(gen));
+  static void _generate_random_alphanumeric(const DynamicVariable &variable,
+                                            std::string &out) {
+    _append_random(out, variable.from, _alphanumeric);
   }
 
-  static std::string _generate_random_float(const std::string_view params) {
-    std::random_device rd;
-    // TODO(stanley): maybe should be static and reuse
-    std::mt19937 gen(rd());
+  static void _generate_random_hexadecimal(const DynamicVariable &variable,
+                                           std::string &out) {
+    if (variable.from <= 0) {
+      return;
+    }
 
-    double from = 0.0, to = 1000.0;
+    // Sixteen digits per random word, no rejection needed
+    const size_t start = out.size();
+    out.resize(start + variable.from);
+    auto &random = _random();
 
-    if (!params.empty()) {
-      std::stringstream ss((std::string(params)));
-      char comma;
-      ss >> from >> comma >> to;
+    for (size_t i = start; i < out.size(); i += 16) {
+      uint64_t word = random();
+      for (size_t j = i; j < std::min(i + 16, out.size()); j++, word >>= 4) {
+        out[j] = _hex_digits[word & 0xF];
+      }
     }
+  }
 
-    std::uniform_real_distribution<> dis(from, to);
+  static void _generate_random_email(const DynamicVariable &,
+                                     std::string &out) {
+    _append_random(out, 8, _alphabetic);
+    out += '@';
+    _append_random(out, 6, _alphabetic);
+    out += '.';
+    _append_random(out, 3, _alphabetic);
+  }
 
-    return std::format("{:.6f}", dis(gen));
+  static void _append_number(std::string &out, const int64_t number) {
+    char buffer[24];
+    const auto result = std::to_chars(buffer, buffer + sizeof(buffer), number);
+    out.append(buffer, result.ptr);
   }
+};
 
-  static std::string
-  _generate_random_alphabetic(const std::string_view params) {
-    int length = 10;
+// Pull reader over JSON text, just enough for environment files and for
+// picking values out of response bodies. No document is built: callers walk
+// objects member by member and skip whatever they don't need. Every read
+// returns false on malformed input, leaving the cursor where it failed.
+class JsonReader {
+public:
+  explicit JsonReader(const std::string_view text) : _text(text) {}
 
-    if (!params.empty()) {
-      std::stringstream ss((std::string(params)));
-      ss >> length;
+  // Calls `on_member(key)` for every member of the object at the cursor;
+  // the callback must consume the value and return false to stop early.
+  bool read_object(auto &&on_member) {
+    if (!_consume('{')) {
+      return false;
     }
-
-    if (length <= 0) {
-      return "";
+    if (_consume('}')) {
+      return true;
     }
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 51); // 26 lowercase + 26 uppercase
+    // Only keys with escapes are copied, into here
+    std::string unescaped;
+    do {
+      std::optional<std::string_view> key;
+      if (!_skip_whitespace() || !(key = _read_key(unescaped)) ||
+          !_consume(':')) {
+        return false;
+      }
+      if (!on_member(*key)) {
+        return false;
+      }
+    } while (_consume(','));
 
-    std::string result;
-    result.reserve(length);
+    return _consume('}');
+  }
 
-    for (int i = 0; i < length; i++) {
-      int c = dis(gen);
-      if (c < 26) {
-        result += 'a' + c;
-      } else {
-        result += 'A' + (c - 26);
-      }
+  // Same as read_object for arrays, `on_element` gets the element index
+  bool read_array(auto &&on_element) {
+    if (!_consume('[')) {
+      return false;
+    }
+    if (_consume(']')) {
+      return true;
     }
 
-    return result;
-  }
+    size_t index = 0;
+    do {
+      if (!on_element(index++)) {
+        return false;
+      }
+    } while (_consume(','));
 
-  static std::string
-  _generate_random_alphanumeric(const std::string_view params) {
-    int length = 10;
+    return _consume(']');
+  }
 
-    if (!params.empty()) {
-      std::stringstream ss((std::string(params)));
-      ss >> length;
+  // Strings come out unescaped, numbers, booleans and null as written.
+  // Objects and arrays come out as their JSON text.
+  bool read_value(std::string &out) {
+    if (!_skip_whitespace()) {
+      return false;
     }
-
-    if (length <= 0) {
-      return "";
+    if (_text[_pos] == '"') {
+      out.clear();
+      return _read_string(out);
     }
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
-
-    const std::string charset =
-        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
-    std::uniform_int_distribution<> dis(0, charset.size() - 1);
+    const size_t start = _pos;
+    if (!skip_value()) {
+      return false;
+    }
+    out.assign(_text.substr(start, _pos - start));
+    return true;
+  }
 
-    std::string result;
-    result.reserve(length);
+  bool skip_value() {
+    if (!_skip_whitespace()) {
+      return false;
+    }
 
-    for (int i = 0; i < length; i++) {
-      result += charset[dis(gen)];
+    switch (_text[_pos]) {
+    case '{':
+      return read_object([this](std::string_view) { return skip_value(); });
+    case '[':
+      return read_array([this](size_t) { return skip_value(); });
+    case '"': {
+      // Only looking for the closing quote, escapes aside
+      for (_pos++; _pos < _text.size() && _text[_pos] != '"'; _pos++) {
+        if (_text[_pos] == '\\') {
+          _pos++;
+        }
+      }
+      return _pos++ < _text.size();
+    }
+    default: {
+      // Numbers and literals run up to the next delimiter
+      const size_t start = _pos;
+      _pos = std::min(_text.find_first_of(",}] \t\r\n", _pos), _text.size());
+      return _pos > start;
     }
+    }
+  }
 
-    return result;
+  // True once only whitespace is left
+  bool at_end() { return !_skip_whitespace(); }
+
+  // Reads the value at `path` like read_value. Paths are the JSONPath
+  // subset of JetBrains' client: `$.user.tags[0]`, `$['odd.key']`. Members
+  // off the path are skipped unread, and reading stops at the value, so
+  // the rest of a large document is never looked at. False when the path
+  // is not in the document.
+  bool read_path(const std::string_view path, std::string &out) {
+    return path.starts_with('$') && _read_path(path.substr(1), out);
   }
 
-  static std::string
-  _generate_random_hexadecimal(const std::string_view params) {
-    int length = 10;
+private:
+  std::string_view _text;
+  size_t _pos = 0;
 
-    if (!params.empty()) {
-      std::stringstream ss((std::string(params)));
-      ss >> length;
+  bool _read_path(const std::string_view path, std::string &out) {
+    if (path.empty()) {
+      return read_value(out);
     }
 
-    if (length <= 0) {
-      return "";
+    // `.key`
+    if (path.starts_with('.')) {
+      const size_t end = std::min(path.find_first_of(".[", 1), path.size());
+      return _read_member(path.substr(1, end - 1), path.substr(end), out);
     }
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 15);
+    if (!path.starts_with('[') || path.size() < 2) {
+      return false;
+    }
 
-    std::string result;
-    result.reserve(length);
+    // `['key']` or `["key"]`
+    if (path[1] == '\'' || path[1] == '"') {
+      const char closing[] = {path[1], ']'};
+      const size_t end = path.find(std::string_view(closing, 2), 2);
+      return end != std::string_view::npos &&
+             _read_member(path.substr(2, end - 2), path.substr(end + 2), out);
+    }
 
-    for (int i = 0; i < length; i++) {
-      int value = dis(gen);
-      result +=
-          static_cast<char>(value < 10 ? '0' + value : 'a' + (value - 10));
+    // `[index]`
+    size_t index = 0;
+    const auto [end, error] =
+        std::from_chars(path.data() + 1, path.data() + path.size(), index);
+    if (error != std::errc() || end == path.data() + path.size() ||
+        *end != ']') {
+      return false;
     }
 
-    return result;
+    const std::string_view rest = path.substr(end - path.data() + 1);
+    bool found = false;
+    read_array([&](size_t element) {
+      if (element != index) {
+        return skip_value();
+      }
+      found = _read_path(rest, out);
+      // Stops the scan, there is nothing left to look for
+      return false;
+    });
+    return found;
   }
 
-  static std::string _generate_random_email() {
-    std::string username = _generate_random_alphabetic("8");
-    std::string domain = _generate_random_alphabetic("6");
-    std::string tld = _generate_random_alphabetic("3");
-
-    return std::format("{}@{}.{}", username, domain, tld);
+  bool _read_member(const std::string_view key, const std::string_view rest,
+                    std::string &out) {
+    bool found = false;
+    read_object([&](std::string_view member) {
+      if (member != key) {
+        return skip_value();
+      }
+      found = _read_path(rest, out);
+      return false;
+    });
+    return found;
   }
-};
-
-// Forward declarations
-class HttpRequest;
-class RequestAdapter;
-class CurlAdapter;
-
-// Plain Old Data
-struct HttpResponse {
-  long status_code = 0;
-  std::optional<std::string> body;
-  std::map<std::string, std::string> headers;
-};
 
-// HTTP Request structure
-class HttpRequest {
-public:
-  std::string method;
-  std::string url;
-  std::string name;
-  std::map<std::string, std::string> headers;
-  std::string body;
-
-  HttpRequest(const std::string &method, const std::string &url,
-              const std::string &name = "")
-      : method(method), url(url), name(name) {}
+  // False when the text is exhausted
+  bool _skip_whitespace() {
+    _pos = std::min(_text.find_first_not_of(" \t\r\n", _pos), _text.size());
+    return _pos < _text.size();
+  }
 
-  void add_header(const std::string &key, const std::string &value) {
-    headers[key] = value;
+  bool _consume(const char expected) {
+    if (_skip_whitespace() && _text[_pos] == expected) {
+      _pos++;
+      return true;
+    }
+    return false;
   }
 
-  void set_body(const std::string &body) { this->body = body; }
-};
+  // A member key, viewed in the text unless it has escapes to undo
+  std::optional<std::string_view> _read_key(std::string &unescaped) {
+    if (_text[_pos] != '"') {
+      return std::nullopt;
+    }
 
-// Abstract adapter for request engines
-class RequestAdapter {
-public:
-  virtual ~RequestAdapter() = default;
-  virtual std::expected<HttpResponse, AgatetepeError>
-  do_request(const HttpRequest &request) = 0;
-};
+    const size_t start = _pos + 1;
+    const size_t end = _text.find_first_of("\"\\", start);
+    if (end == std::string_view::npos) {
+      return std::nullopt;
+    }
+    if (_text[end] == '"') {
+      _pos = end + 1;
+      return _text.substr(start, end - start);
+    }
 
-// cURL adapter implementation
-class CurlAdapter : public RequestAdapter {
-public:
-  CurlAdapter() {
-    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
-      throw std::runtime_error("Failed to initialise libcurl");
+    unescaped.clear();
+    if (!_read_string(unescaped)) {
+      return std::nullopt;
     }
+    return unescaped;
   }
 
-  ~CurlAdapter() override { curl_global_cleanup(); }
-
-  std::expected<HttpResponse, AgatetepeError>
-  do_request(const HttpRequest &request) override {
-    CURL *curl = curl_easy_init();
-    if (!curl) {
-      return std::unexpected(
-          AgatetepeError{.code = e_agatetepe_error::curl_error,
-                         .message = "Failed to initialise cURL easy handler."});
+  bool _read_string(std::string &out) {
+    if (_text[_pos] != '"') {
+      return false;
     }
 
-    std::string response_body;
-    std::map<std::string, std::string> response_headers;
-    struct curl_slist *headers_list = nullptr;
-
-    // Set the URL
-    curl_easy_setopt(curl, CURLOPT_URL, request.url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _curl_write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_body);
+    for (_pos++; _pos < _text.size(); _pos++) {
+      const char c = _text[_pos];
+      if (c == '"') {
+        _pos++;
+        return true;
+      }
+      if (c != '\\') {
+        out += c;
+        continue;
+      }
 
-    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, _curl_header_callback);
-    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response_headers);
+      if (++_pos == _text.size()) {
+        return false;
+      }
 
-    // --- Set HTTP Method and Body ---
-    if (request.method == "POST") {
-      curl_easy_setopt(curl, CURLOPT_POST, 1L);
-      curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.body.c_str());
-    } else if (request.method == "PUT" || request.method == "PATCH" ||
-               request.method == "DELETE") {
-      curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, request.method.c_str());
-      if (!request.body.empty()) {
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.body.c_str());
+      switch (_text[_pos]) {
+      case 'n':
+        out += '\n';
+        break;
+      case 't':
+        out += '\t';
+        break;
+      case 'r':
+        out += '\r';
+        break;
+      case 'b':
+        out += '\b';
+        break;
+      case 'f':
+        out += '\f';
+        break;
+      case 'u': {
+        uint32_t code_point = 0;
+        const auto digits = _text.substr(_pos + 1, 4);
+        if (digits.size() != 4 ||
+            std::from_chars(digits.data(), digits.data() + 4, code_point, 16)
+                    .ptr != digits.data() + 4) {
+          return false;
+        }
+        _pos += 4;
+        _append_utf8(out, code_point);
+        break;
+      }
+      default:
+        // `\"`, `\\` and `\/`
+        out += _text[_pos];
       }
-    } else if (request.method != "GET") {
-      curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, request.method.c_str());
     }
 
-    // --- Set Headers ---
-    for (const auto &header : request.headers) {
-      std::string header_string = header.first + ": " + header.second;
-      headers_list = curl_slist_append(headers_list, header_string.c_str());
-    }
+    return false;
+  }
 
-    if (headers_list) {
-      curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers_list);
+  // Surrogate pairs are not combined, they are rare in the files we read
+  static void _append_utf8(std::string &out, const uint32_t code_point) {
+    if (code_point < 0x80) {
+      out += static_cast<char>(code_point);
+    } else if (code_point < 0x800) {
+      out += static_cast<char>(0xC0 | (code_point >> 6));
+      out += static_cast<char>(0x80 | (code_point & 0x3F));
+    } else {
+      out += static_cast<char>(0xE0 | (code_point >> 12));
+      out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (code_point & 0x3F));
     }
+  }
+};
 
-    // Perform the request
-    CURLcode res = curl_easy_perform(curl);
+// Writes one JSON object per line (NDJSON). Each record is built in a
+// reused buffer and handed to the stream in one write, flushed right away,
+// so a consumer reading the pipe sees whole records as they complete.
+class JsonLineWriter {
+public:
+  explicit JsonLineWriter(std::FILE *out) : _out(out) {}
 
-    // Check for transport errors (e.g., network failure, couldn't resolve host)
-    if (res != CURLE_OK) {
-      // Cleanup resources before returning error
-      curl_easy_cleanup(curl);
-      curl_slist_free_all(headers_list);
-      return std::unexpected(AgatetepeError{
-          .code = e_agatetepe_error::curl_error,
-          .message = std::format("curl_easy_perform() failed: {}",
-                                 curl_easy_strerror(res))});
-    }
+  JsonLineWriter &field(const std::string_view key,
+                        const std::string_view value) {
+    _key(key);
+    _append_string(value);
+    return *this;
+  }
 
-    // Get the HTTP status code. This is now part of a successful transport.
-    long httpCode = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+  JsonLineWriter &field(const std::string_view key, const char *value) {
+    return field(key, std::string_view(value));
+  }
 
-    // Cleanup resources
-    curl_easy_cleanup(curl);
-    curl_slist_free_all(headers_list);
+  JsonLineWriter &field(const std::string_view key, const bool value) {
+    _key(key);
+    _buffer += value ? "true" : "false";
+    return *this;
+  }
 
-    // Construct and return the successful response object.
-    // The caller is now responsible for checking the status code.
-    HttpResponse response;
-    response.status_code = httpCode;
-    response.body = response_body;
-    response.headers = std::move(response_headers);
+  JsonLineWriter &field(const std::string_view key,
+                        const std::integral auto value) {
+    _key(key);
+    char digits[24];
+    _buffer.append(digits,
+                   std::to_chars(digits, digits + sizeof(digits), value).ptr);
+    return *this;
+  }
 
-    return response;
+  // Milliseconds with microsecond precision
+  JsonLineWriter &field(const std::string_view key,
+                        const std::chrono::microseconds value) {
+    _key(key);
+    std::format_to(std::back_inserter(_buffer), "{:.3f}",
+                   static_cast<double>(value.count()) / 1000.0);
+    return *this;
   }
 
-private:
-  static size_t _curl_write_callback(void *contents, size_t size, size_t nmemb,
-                                     std::string *userp) {
-    size_t total_size = size * nmemb;
-    if (userp) {
-      userp->append((char *)contents, total_size);
-    }
-    return total_size;
+  JsonLineWriter &null_field(const std::string_view key) {
+    _key(key);
+    _buffer += "null";
+    return *this;
   }
 
-  static size_t _curl_header_callback(char *buffer, size_t size, size_t nitems,
-                                      void *userdata) {
-    auto *headers = static_cast<std::map<std::string, std::string> *>(userdata);
-    size_t total_size = size * nitems;
+  JsonLineWriter &begin_object(const std::string_view key) {
+    _key(key);
+    _buffer += '{';
+    _first = true;
+    return *this;
+  }
 
-    std::string header_line(buffer, total_size);
+  JsonLineWriter &end_object() {
+    _buffer += '}';
+    _first = false;
+    return *this;
+  }
 
-    header_line.erase(header_line.find_last_not_of("\r\n") + 1);
+  // False when the stream failed, e.g. a closed pipe
+  bool end_record() {
+    _buffer += "}\n";
+    const bool written =
+        std::fwrite(_buffer.data(), 1, _buffer.size(), _out) ==
+            _buffer.size() &&
+        std::fflush(_out) == 0;
+    _buffer.clear();
+    _first = true;
+    return written;
+  }
 
-    // Ignore empty lines and the HTTP status line (e.g., "HTTP/1.1 200 OK")
-    if (header_line.empty() || header_line.find(':') == std::string::npos) {
-      return total_size;
+private:
+  std::FILE *_out;
+  std::string _buffer;
+  bool _first = true;
+
+  void _key(const std::string_view key) {
+    if (_buffer.empty()) {
+      _buffer += '{';
+    } else if (!_first) {
+      _buffer += ',';
     }
+    _first = false;
+    _append_string(key);
+    _buffer += ':';
+  }
 
-    size_t colon_position = header_line.find(':');
-    std::string key = header_line.substr(0, colon_position);
-    std::string value = header_line.substr(colon_position + 1);
-
-    // Trim
-    key.erase(0, key.find_first_not_of(' '));
-    key.erase(key.find_last_not_of(' ') + 1);
-    value.erase(0, value.find_first_not_of(' '));
-    value.erase(value.find_last_not_of(' ') + 1);
-
-    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+  void _append_string(const std::string_view text) {
+    _buffer += '"';
+    for (const char c : text) {
+      switch (c) {
+      case '"':
+        _buffer += "\\\"";
+        break;
+      case '\\':
+        _buffer += "\\\\";
+        break;
+      case '\n':
+        _buffer += "\\n";
+        break;
+      case '\r':
+        _buffer += "\\r";
+        break;
+      case '\t':
+        _buffer += "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          std::format_to(std::back_inserter(_buffer), "\\u{:04x}",
+                         static_cast<unsigned>(c));
+        } else {
+          _buffer += c;
+        }
+      }
+    }
+    _buffer += '"';
+  }
+};
 
-    (*headers)[key] = value;
+// Lets string keyed hash maps be searched with a string_view, without
+// building a temporary key
+struct StringHash {
+  using is_transparent = void;
 
-    return total_size;
+  size_t operator()(const std::string_view text) const {
+    return std::hash<std::string_view>{}(text);
   }
 };
 
-// Terminal menu for selecting requests
-class RequestMenu {
+// Variables of one environment, read from `http-client.env.json` and
+// `http-client.private.env.json` next to the request file:
+//
+//   { "$shared": { "host": "localhost" }, "dev": { "token": "..." } }
+//
+// The selected environment overrides `$shared` whichever file either comes
+// from, and at each of the two levels the private file overrides the public
+// one: public `$shared`, private `$shared`, public environment, then private
+// environment.
+class Environment {
 public:
-  void add_request(std::shared_ptr<HttpRequest> request) {
-    _requests.push_back(request);
-  }
-
-  void jump_to(int index) { _selected = index; }
-
-  void display() {
-    std::print("\033[2J\033[H");
+  static constexpr std::string_view public_file = "http-client.env.json";
+  static constexpr std::string_view private_file =
+      "http-client.private.env.json";
+
+  static std::expected<Environment, AgatetepeError>
+  load(const std::filesystem::path &directory, const std::string_view name) {
+    // `$shared` and the selected environment, each merged across the files
+    Environment shared;
+    Environment selected;
+    bool found = false;
+
+    for (const auto file : {public_file, private_file}) {
+      const auto path = directory / file;
+      if (!std::filesystem::exists(path)) {
+        continue;
+      }
 
-    std::println("HTTP Request Selector");
-    std::println("=====================\n");
+      auto reader = create_mmap_reader(path.string());
+      if (!reader->is_open()) {
+        return std::unexpected(
+            AgatetepeError{.code = e_agatetepe_error::io_error,
+                           .message = std::format("Error: Could not open {}",
+                                                  path.string())});
+      }
 
-    if (_requests.empty()) {
-      std::println("No requests available.");
-      return;
-    }
+      JsonReader json(std::string_view(reader->get_data(), reader->get_size()));
+      std::map<std::string, Environment, std::less<>> sections;
 
-    if (_show_details && _selected >= 0 &&
-        _selected < static_cast<int>(_requests.size())) {
-      auto request = _requests[_selected];
-      std::println("Name: {}", request->name);
-      std::println("Method: {}", request->method);
-      std::println("URL: {}", request->url);
+      const bool valid =
+          json.read_object([&](std::string_view section) {
+            if (section != name && section != "$shared") {
+              return json.skip_value();
+            }
+            auto &variables = sections[std::string(section)]._variables;
+            return json.read_object([&](std::string_view key) {
+              return json.read_value(variables[std::string(key)]);
+            });
+          }) &&
+          json.at_end();
+
+      if (!valid) {
+        return std::unexpected(AgatetepeError{
+            .code = e_agatetepe_error::parse_error,
+            .message = std::format("Error: {} is not a valid environment file",
+                                   path.string())});
+      }
 
-      if (!request->headers.empty()) {
-        std::println("Headers:");
-        for (const auto &header : request->headers) {
-          std::println("   {}: {}", header.first, header.second);
+      found = found || sections.contains(name);
+      for (auto &[section, merged] :
+           {std::pair<std::string_view, Environment &>{"$shared", shared},
+            {name, selected}}) {
+        if (auto it = sections.find(section); it != sections.end()) {
+          for (auto &[key, value] : it->second._variables) {
+            merged._variables.insert_or_assign(key, std::move(value));
+          }
         }
       }
+    }
 
-      if (!request->body.empty()) {
-        std::println("Body:\n{}", request->body);
-      }
+    if (!found) {
+      return std::unexpected(AgatetepeError{
+          .code = e_agatetepe_error::parse_error,
+          .message = std::format(
+              "Error: Environment \"{}\" not found in {} or {} of {}", name,
+              public_file, private_file, directory.string())});
+    }
 
-      std::println("\nPress 'd' to toggle details, arrow keys to navigate, "
-                   "Enter to select, q to quit.");
+    for (auto &[key, value] : selected._variables) {
+      shared._variables.insert_or_assign(key, std::move(value));
+    }
+    return shared;
+  }
+
+  // The value lives as long as the environment
+  std::optional<std::string_view> find(const std::string_view name) const {
+    if (auto it = _variables.find(name); it != _variables.end()) {
+      return it->second;
+    }
+    return std::nullopt;
+  }
+
+  // Changes whenever a variable does, regardless of map order
+  uint64_t fingerprint() const {
+    uint64_t sum = 0;
+    for (const auto &[key, value] : _variables) {
+      Fnv1a hash;
+      hash.update(key);
+      hash.update(std::string_view("", 1));
+      hash.update(value);
+      sum += hash.value();
+    }
+    return sum;
+  }
+
+private:
+  std::unordered_map<std::string, std::string, StringHash, std::equal_to<>>
+      _variables;
+};
+
+// Variable scope of one parse: the file's `@name = value` declarations, on
+// top of the selected environment. Lookups don't mutate anything, so once
+// declarations are in, any number of threads can compile against it.
+class ParseContext {
+public:
+  explicit ParseContext(std::shared_ptr<const Environment> environment = nullptr)
+      : _environment(std::move(environment)) {}
+
+  // Both views must outlive the parsed requests, they point into the
+  // parsed text
+  void declare(const std::string_view name, const std::string_view value) {
+    _variables.insert_or_assign(name, value);
+    _declarations.update(name);
+    _declarations.update(std::string_view("=", 1));
+    _declarations.update(value);
+    _declarations.update(std::string_view("", 1));
+  }
+
+  // Of the declarations so far, in order. Over the same environment, two
+  // contexts with the same fingerprint resolve every name alike.
+  uint64_t fingerprint() const { return _declarations.value(); }
+
+  std::optional<std::string_view> find(const std::string_view name) const {
+    if (auto it = _variables.find(name); it != _variables.end()) {
+      return it->second;
+    }
+    return _environment ? _environment->find(name) : std::nullopt;
+  }
+
+  const std::shared_ptr<const Environment> &environment() const {
+    return _environment;
+  }
+
+private:
+  std::unordered_map<std::string_view, std::string_view, StringHash,
+                     std::equal_to<>>
+      _variables;
+  std::shared_ptr<const Environment> _environment;
+  Fnv1a _declarations;
+};
+
+// `{{login.response.body.$.token}}` or `{{login.response.headers.X-Id}}`:
+// a value out of the last response to the request named `login`
+struct ResponseReference {
+  enum class Part { body, headers };
+
+  std::string_view request;
+  Part part = Part::body;
+  // JSONPath into the body, empty for the whole body, or a header name
+  std::string_view path;
+
+  // Null when `name` is not a response reference
+  static std::optional<ResponseReference> parse(const std::string_view name) {
+    static constexpr std::string_view infix = ".response.";
+
+    const size_t at = name.find(infix);
+    if (at == 0 || at == std::string_view::npos) {
+      return std::nullopt;
+    }
+
+    const std::string_view part = name.substr(at + infix.size());
+    ResponseReference reference;
+    reference.request = name.substr(0, at);
+
+    if (part == "body") {
+      return reference;
+    }
+    if (part.starts_with("body.$")) {
+      reference.path = part.substr(5);
+      return reference;
+    }
+    if (part.starts_with("headers.") && part.size() > 8) {
+      reference.part = Part::headers;
+      reference.path = part.substr(8);
+      return reference;
+    }
+
+    return std::nullopt;
+  }
+
+  bool operator==(const ResponseReference &) const = default;
+};
+
+class ResponseStore;
+
+// A string with `{{...}}` placeholders, compiled once at parse time into a
+// flat list of literal spans and variable slots. Variables already known
+// when compiling become literals; dynamic ones (`{{$uuid}}`) stay as slots
+// and are evaluated again on every render, so each send of the request gets
+// fresh values. Response references stay as slots too, they are looked up
+// in a ResponseStore at render time.
+//
+// Segments only view their text: it must outlive the template, which is
+// what ParsedCollection guarantees for parsed requests.
+class RequestTemplate {
+public:
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
+  enum class SlotKind { literal, variable, dynamic, response };
+
+  struct Segment {
+    SlotKind kind = SlotKind::literal;
+    // literal text, variable name or dynamic expression (`$random.int(1,9)`)
+    std::string_view text;
+    // What dynamic and response slots render from, compiled once out of the
+    // text. They share the room, segments are the bulk of a parsed
+    // collection.
+    std::variant<std::monostate, DynamicVariable, ResponseReference> compiled =
+        {};
+
+    // Of dynamic slots
+    const DynamicVariable &dynamic() const {
+      return std::get<DynamicVariable>(compiled);
+    }
+
+    // Of response slots, its views slices of the text
+    const ResponseReference &reference() const {
+      return std::get<ResponseReference>(compiled);
+    }
+
+    // What's compiled follows from the text
+    bool operator==(const Segment &other) const {
+      return kind == other.kind && text == other.text;
+    }
+  };
+
+  RequestTemplate() = default;
+
+  explicit RequestTemplate(allocator_type allocator) : _segments(allocator) {}
+
+  // Single pass over `input`; placeholders are not searched again inside
+  // substituted values.
+  static RequestTemplate compile(const std::string_view input,
+                                 const ParseContext &context,
+                                 allocator_type allocator = {}) {
+    RequestTemplate compiled(allocator);
+    size_t pos = 0;
+
+    // Sized upfront, arenas don't reclaim what a growing vector leaves
+    // behind: each placeholder adds at most a slot and a literal
+    size_t placeholders = 0;
+    for (size_t at = input.find("{{"); at != std::string_view::npos;
+         at = input.find("{{", at + 2)) {
+      placeholders++;
+    }
+    compiled._segments.reserve(2 * placeholders + 1);
+
+    while (pos < input.size()) {
+      // Look for the start of a variable
+      const size_t start = input.find("{{", pos);
+      // Look for the end of the variable
+      const size_t end = start == std::string_view::npos
+                             ? std::string_view::npos
+                             : input.find("}}", start + 2);
+
+      // No more (well formed) variables, the rest is literal
+      if (end == std::string_view::npos) {
+        compiled._append_literal(input.substr(pos));
+        break;
+      }
+
+      compiled._append_literal(input.substr(pos, start - pos));
+
+      const std::string_view name = input.substr(start + 2, end - start - 2);
+      if (name.starts_with("$")) {
+        compiled._segments.push_back(
+            {.kind = SlotKind::dynamic,
+             .text = name,
+             .compiled = DynamicVariableResolver::compile(name)});
+      } else if (auto value = context.find(name)) {
+        compiled._append_literal(*value);
+      } else if (auto reference = ResponseReference::parse(name)) {
+        compiled._segments.push_back({.kind = SlotKind::response,
+                                      .text = name,
+                                      .compiled = *reference});
+      } else {
+        compiled._segments.push_back({.kind = SlotKind::variable, .text = name});
+      }
+
+      pos = end + 2;
+    }
+
+    return compiled;
+  }
+
+  // Appends the rendered template to `out`, callers keep `out` around to
+  // reuse its capacity between renders. Response slots read `responses`.
+  void render_into(std::string &out,
+                   const ResponseStore *responses = nullptr) const {
+    for (const auto &segment : _segments) {
+      switch (segment.kind) {
+      case SlotKind::literal:
+        out += segment.text;
+        break;
+      case SlotKind::dynamic:
+        segment.dynamic().append_to(out);
+        break;
+      case SlotKind::response:
+        _append_response(out, segment.reference(), responses);
+        break;
+      case SlotKind::variable:
+        // Unknown variables render as nothing
+        break;
+      }
+    }
+  }
+
+  std::string render() const {
+    std::string out;
+    render_into(out);
+    return out;
+  }
+
+  // Human readable form, slots are shown as their `{{...}}` source
+  std::string display() const {
+    std::string out;
+    for (const auto &segment : _segments) {
+      if (segment.kind == SlotKind::literal) {
+        out += segment.text;
+      } else {
+        out += std::format("{{{{{}}}}}", segment.text);
+      }
+    }
+    return out;
+  }
+
+  bool empty() const { return _segments.empty(); }
+
+  bool operator==(const RequestTemplate &other) const {
+    return _segments == other._segments;
+  }
+
+  const std::pmr::vector<Segment> &segments() const { return _segments; }
+
+  // Copy of the template in `allocator`, its texts passed through `rebase`,
+  // see HttpRequestParser::reparse
+  RequestTemplate rebased(const auto &rebase, allocator_type allocator) const {
+    RequestTemplate copy(allocator);
+    copy._segments.reserve(_segments.size());
+
+    for (Segment segment : _segments) {
+      segment.text = rebase(segment.text);
+      if (auto *reference = std::get_if<ResponseReference>(&segment.compiled)) {
+        reference->request = segment.text.substr(0, reference->request.size());
+        reference->path =
+            segment.text.substr(segment.text.size() - reference->path.size());
+      }
+      copy._segments.push_back(segment);
+    }
+
+    return copy;
+  }
+
+  // Rebuilds a template out of the segments of an earlier compile, see
+  // ParseCache. Dynamic and response slots are compiled again from their
+  // text.
+  static RequestTemplate restore(const std::span<const Segment> segments,
+                                 allocator_type allocator = {}) {
+    RequestTemplate restored(allocator);
+    restored._segments.reserve(segments.size());
+
+    for (Segment segment : segments) {
+      if (segment.kind == SlotKind::dynamic) {
+        segment.compiled = DynamicVariableResolver::compile(segment.text);
+      } else if (segment.kind == SlotKind::response) {
+        segment.compiled =
+            ResponseReference::parse(segment.text).value_or(ResponseReference{});
+      }
+      restored._segments.push_back(segment);
+    }
+
+    return restored;
+  }
+
+private:
+  std::pmr::vector<Segment> _segments;
+
+  // Defined after ResponseStore. Responses not received yet render as
+  // nothing, like unknown variables.
+  static void _append_response(std::string &out,
+                               const ResponseReference &reference,
+                               const ResponseStore *responses);
+
+  // Adjacent literals stay separate segments, merging them would need a copy
+  void _append_literal(const std::string_view text) {
+    if (!text.empty()) {
+      _segments.push_back({.kind = SlotKind::literal, .text = text});
+    }
+  }
+};
+
+// Forward declarations
+class HttpRequest;
+class RequestAdapter;
+class CurlAdapter;
+
+// Optional end of a request line, `GET https://host/ HTTP/2`. Over
+// cleartext, `HTTP/2` upgrades an HTTP/1.1 request while `HTTP/2 (Prior
+// Knowledge)` speaks HTTP/2 right away.
+enum class HttpVersion {
+  unspecified,
+  http1_0,
+  http1_1,
+  http2,
+  http2_prior_knowledge,
+  http3
+};
+
+static constexpr std::array<std::pair<HttpVersion, std::string_view>, 5>
+    http_version_names = {
+        {{HttpVersion::http1_0, "HTTP/1.0"},
+         {HttpVersion::http1_1, "HTTP/1.1"},
+         {HttpVersion::http2, "HTTP/2"},
+         {HttpVersion::http2_prior_knowledge, "HTTP/2 (Prior Knowledge)"},
+         {HttpVersion::http3, "HTTP/3"}}};
+
+static constexpr std::string_view http_version_name(HttpVersion version) {
+  for (const auto &[known, name] : http_version_names) {
+    if (known == version) {
+      return name;
+    }
+  }
+  return "HTTP";
+}
+
+// Milestones of a transfer as reported by libcurl. Like curl's own
+// CURLINFO_*_TIME_T values, each one is measured from the start of the
+// request, so a phase is the difference between two consecutive milestones.
+struct HttpTimings {
+  std::chrono::microseconds name_lookup{0};
+  std::chrono::microseconds connect{0};
+  // zero for plain HTTP
+  std::chrono::microseconds tls_handshake{0};
+  std::chrono::microseconds pre_transfer{0};
+  std::chrono::microseconds time_to_first_byte{0};
+  std::chrono::microseconds total{0};
+
+  uint64_t uploaded_bytes = 0;
+  uint64_t downloaded_bytes = 0;
+  // average bytes per second over the whole transfer
+  uint64_t upload_speed = 0;
+  uint64_t download_speed = 0;
+};
+
+// Response header fields as received: every name and value is appended to
+// one byte buffer, indexed by a flat array of spans into it. Names keep
+// their casing, and repeated fields (Set-Cookie, Via) are all kept in
+// arrival order. Lookups compare names case-insensitively in place.
+class ResponseHeaders {
+public:
+  struct Field {
+    std::string_view name;
+    std::string_view value;
+  };
+
+  // Takes one raw line as handed over by the transport, terminator
+  // included. A status line starts a new header block (after a 100 Continue
+  // or a proxy's CONNECT response), dropping the fields seen so far.
+  void append_line(std::string_view line) {
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+      line.remove_suffix(1);
+    }
+
+    if (line.starts_with("HTTP/")) {
+      _buffer.clear();
+      _index.clear();
+      return;
+    }
+
+    // Obsolete line folding continues the previous value
+    if (!line.empty() && (line.front() == ' ' || line.front() == '\t')) {
+      if (!_index.empty() && _index.back().value.offset +
+                                     _index.back().value.length ==
+                                 _buffer.size()) {
+        const auto continuation = _trim(line);
+        _buffer += ' ';
+        _buffer += continuation;
+        _index.back().value.length += 1 + continuation.size();
+      }
+      return;
+    }
+
+    const size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      return;
+    }
+
+    const auto name = _trim(line.substr(0, colon));
+    const auto value = _trim(line.substr(colon + 1));
+
+    if (_buffer.empty()) {
+      _buffer.reserve(_initial_capacity);
+    }
+
+    _index.push_back({.name = _append(name), .value = _append(value)});
+  }
+
+  // First field called `name`, if any
+  std::optional<std::string_view> find(const std::string_view name) const {
+    for (const auto &entry : _index) {
+      if (equals_ignoring_case(_view(entry.name), name)) {
+        return _view(entry.value);
+      }
+    }
+    return std::nullopt;
+  }
+
+  auto fields() const {
+    return _index | std::views::transform([this](const Entry &entry) {
+             return Field{.name = _view(entry.name),
+                          .value = _view(entry.value)};
+           });
+  }
+
+  // Every field called `name`, in arrival order
+  auto find_all(const std::string_view name) const {
+    return fields() | std::views::filter([name](const Field &field) {
+             return equals_ignoring_case(field.name, name);
+           });
+  }
+
+  size_t size() const { return _index.size(); }
+
+  bool empty() const { return _index.empty(); }
+
+private:
+  // Offsets rather than views, the buffer may move while it grows
+  struct Span {
+    uint32_t offset = 0;
+    uint32_t length = 0;
+  };
+
+  struct Entry {
+    Span name;
+    Span value;
+  };
+
+  static constexpr size_t _initial_capacity = 1024;
+
+  std::string _buffer;
+  std::vector<Entry> _index;
+
+  Span _append(const std::string_view text) {
+    const Span span{.offset = static_cast<uint32_t>(_buffer.size()),
+                    .length = static_cast<uint32_t>(text.size())};
+    _buffer += text;
+    return span;
+  }
+
+  std::string_view _view(const Span span) const {
+    return std::string_view(_buffer).substr(span.offset, span.length);
+  }
+
+  static std::string_view _trim(std::string_view text) {
+    const size_t start = text.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+      return {};
+    }
+    return text.substr(start, text.find_last_not_of(" \t") - start + 1);
+  }
+};
+
+// Plain Old Data
+// What --cache did with a response
+enum class CacheOutcome {
+  none,
+  // a fresh response, now in the cache
+  stored,
+  // a 304, answered with the cached response
+  revalidated
+};
+
+struct HttpResponse {
+  long status_code = 0;
+  std::optional<std::string> body;
+  ResponseHeaders headers;
+  // Protocol the response came over
+  HttpVersion http_version = HttpVersion::unspecified;
+  // true when the transfer rode on an already open keep-alive connection
+  bool connection_reused = false;
+  CacheOutcome cache = CacheOutcome::none;
+  HttpTimings timings;
+};
+
+// Responses of `# @name` requests, as far as the `{{name.response...}}`
+// slots of other requests need them. Only tracked references are kept: a
+// response is reduced to their values as it is stored, so a multi-MB body
+// doesn't stay around for the sake of one token.
+class ResponseStore {
+public:
+  void track(const ResponseReference &reference) {
+    auto &entry = _entries[reference.request];
+    if (std::ranges::find(entry.references, reference) ==
+        entry.references.end()) {
+      entry.references.push_back(reference);
+    }
+  }
+
+  // Whether responses to `request` are worth storing
+  bool tracks(const std::string_view request) const {
+    return _entries.contains(request);
+  }
+
+  bool received(const std::string_view request) const {
+    auto it = _entries.find(request);
+    return it != _entries.end() && it->second.received;
+  }
+
+  // Replaces what an earlier response to `request` left
+  void store(const std::string_view request, const HttpResponse &response,
+             const std::string_view body) {
+    auto it = _entries.find(request);
+    if (it == _entries.end()) {
+      return;
+    }
+
+    Entry &entry = it->second;
+    entry.received = true;
+    entry.values.assign(entry.references.size(), std::nullopt);
+
+    for (size_t i = 0; i < entry.references.size(); i++) {
+      const ResponseReference &reference = entry.references[i];
+
+      if (reference.part == ResponseReference::Part::headers) {
+        if (auto value = response.headers.find(reference.path)) {
+          entry.values[i].emplace(*value);
+        }
+      } else if (reference.path.empty()) {
+        entry.values[i].emplace(body);
+      } else {
+        std::string value;
+        if (JsonReader(body).read_path(reference.path, value)) {
+          entry.values[i] = std::move(value);
+        }
+      }
+    }
+  }
+
+  // Null until a response came in, and for values it doesn't have
+  const std::string *find(const ResponseReference &reference) const {
+    auto it = _entries.find(reference.request);
+    if (it == _entries.end()) {
+      return nullptr;
+    }
+
+    const Entry &entry = it->second;
+    for (size_t i = 0; i < entry.values.size(); i++) {
+      if (entry.references[i] == reference && entry.values[i]) {
+        return &*entry.values[i];
+      }
+    }
+    return nullptr;
+  }
+
+private:
+  struct Entry {
+    std::vector<ResponseReference> references;
+    // Parallel to `references` once a response came in
+    std::vector<std::optional<std::string>> values;
+    bool received = false;
+  };
+
+  // Keys view the parsed text, like the references
+  std::unordered_map<std::string_view, Entry, StringHash, std::equal_to<>>
+      _entries;
+};
+
+void RequestTemplate::_append_response(std::string &out,
+                                       const ResponseReference &reference,
+                                       const ResponseStore *responses) {
+  if (!responses) {
+    return;
+  }
+  if (const std::string *value = responses->find(reference)) {
+    out += *value;
+  }
+}
+
+// On-disk cache of GET responses, for --cache. Bodies live once per content
+// in `objects/`, named by their hash and size. `entries/` holds a small
+// text file per method and URL listing its variants: the request header
+// values the response varies on, its status and head, and its object.
+// Cached variants are revalidated with If-None-Match / If-Modified-Since,
+// and a 304 is answered with the mapped object, its head updated by the
+// 304's.
+//
+// Writes go to temporary files renamed into place, so concurrent runs
+// never see half a file. Nothing is ever evicted.
+class ResponseCache {
+public:
+  struct Variant {
+    // Request header values named by the response's Vary
+    std::vector<std::pair<std::string, std::string>> vary;
+    long status_code = 0;
+    ResponseHeaders headers;
+    std::string object;
+  };
+
+  // A body on its way into `objects/`, hashed as it is written
+  class ObjectWriter {
+  public:
+    ~ObjectWriter() {
+      if (_file) {
+        std::fclose(_file);
+        std::error_code ignored;
+        std::filesystem::remove(_path, ignored);
+      }
+    }
+
+    ObjectWriter(const ObjectWriter &) = delete;
+    ObjectWriter &operator=(const ObjectWriter &) = delete;
+
+    bool write(const std::string_view chunk) {
+      _hash.update(chunk);
+      _size += chunk.size();
+      return std::fwrite(chunk.data(), 1, chunk.size(), _file) == chunk.size();
+    }
+
+  private:
+    friend class ResponseCache;
+
+    ObjectWriter(std::FILE *file, std::filesystem::path path)
+        : _file(file), _path(std::move(path)) {}
+
+    std::FILE *_file = nullptr;
+    std::filesystem::path _path;
+    Fnv1a _hash;
+    uint64_t _size = 0;
+  };
+
+  static std::filesystem::path default_directory() {
+    return cache_directory() / "responses";
+  }
+
+  static std::expected<std::unique_ptr<ResponseCache>, AgatetepeError>
+  open(const std::filesystem::path &directory) {
+    std::error_code error;
+    for (const auto subdirectory : {"entries", "objects"}) {
+      std::filesystem::create_directories(directory / subdirectory, error);
+      if (error) {
+        return std::unexpected(AgatetepeError{
+            .code = e_agatetepe_error::io_error,
+            .message = std::format("Error: Could not create cache directory "
+                                   "{}: {}",
+                                   (directory / subdirectory).string(),
+                                   error.message())});
+      }
+    }
+
+    return std::unique_ptr<ResponseCache>(new ResponseCache(directory));
+  }
+
+  // Whether a 200 with this head is worth keeping: it must be revalidatable,
+  // and not forbidden from being stored
+  static bool is_storable(const ResponseHeaders &headers) {
+    if (!headers.find("ETag") && !headers.find("Last-Modified")) {
+      return false;
+    }
+    for (const auto &field : headers.find_all("Cache-Control")) {
+      if (field.value.find("no-store") != std::string_view::npos) {
+        return false;
+      }
+    }
+    for (const auto &field : headers.find_all("Vary")) {
+      if (field.value.find('*') != std::string_view::npos) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // The variant of `method url` whose Vary values match the request, as
+  // told by `request_header(name)`
+  std::optional<Variant> lookup(const std::string_view method,
+                                const std::string_view url,
+                                auto &&request_header) const {
+    for (auto &variant : _read_entry(method, url)) {
+      const bool matches = std::ranges::all_of(variant.vary, [&](const auto &pair) {
+        return request_header(pair.first) == pair.second;
+      });
+      if (matches && std::filesystem::exists(_objects() / variant.object)) {
+        return std::move(variant);
+      }
+    }
+    return std::nullopt;
+  }
+
+  // Null when no temporary file could be created
+  std::unique_ptr<ObjectWriter> create_object() {
+    const auto path =
+        _objects() /
+        std::format(".tmp-{:x}-{}",
+                    std::chrono::system_clock::now().time_since_epoch().count(),
+                    _next_temporary++);
+
+    // "x" fails rather than sharing a name with another run
+    std::FILE *file = std::fopen(path.string().c_str(), "wbx");
+    if (!file) {
+      return nullptr;
+    }
+    return std::unique_ptr<ObjectWriter>(new ObjectWriter(file, path));
+  }
+
+  // Names the written body after its content and records `variant` for
+  // it, replacing the variant with the same Vary values
+  bool store(const std::string_view method, const std::string_view url,
+             Variant variant, std::unique_ptr<ObjectWriter> writer) {
+    const bool closed = std::fclose(writer->_file) == 0;
+    writer->_file = nullptr;
+
+    std::error_code error;
+    if (!closed || writer->_size == 0) {
+      std::filesystem::remove(writer->_path, error);
+      return false;
+    }
+
+    // FNV-1a collides easily, so an object of the same name is only shared
+    // when its bytes match. Different content takes the next free suffix.
+    const auto name =
+        std::format("{:016x}-{}", writer->_hash.value(), writer->_size);
+    for (size_t attempt = 0;; attempt++) {
+      variant.object =
+          attempt == 0 ? name : std::format("{}-{}", name, attempt);
+      const auto object = _objects() / variant.object;
+
+      if (!std::filesystem::exists(object)) {
+        std::filesystem::rename(writer->_path, object, error);
+        if (error) {
+          std::filesystem::remove(writer->_path, error);
+          return false;
+        }
+        break;
+      }
+
+      // Identical content is already there, from this or another URL
+      if (_same_contents(writer->_path, object)) {
+        std::filesystem::remove(writer->_path, error);
+        break;
+      }
+    }
+
+    auto variants = _read_entry(method, url);
+    std::erase_if(variants, [&](const Variant &stored) {
+      return stored.vary == variant.vary;
+    });
+    variants.push_back(std::move(variant));
+
+    return _write_entry(method, url, variants);
+  }
+
+  std::unique_ptr<MmapReader> open_object(const Variant &variant) const {
+    return create_mmap_reader((_objects() / variant.object).string());
+  }
+
+  // Takes in the head of a 304 answering a revalidation of `variant`: its
+  // fields replace the stored ones of the same name, except those about
+  // the stored body or the connection. Touches nothing on disk, see
+  // refresh.
+  static void refresh_headers(Variant &variant, const ResponseHeaders &update) {
+    auto kept = [](const std::string_view name) {
+      return std::ranges::none_of(_unrefreshed_headers, [&](auto header) {
+        return equals_ignoring_case(name, header);
+      });
+    };
+
+    ResponseHeaders headers;
+    for (const auto &[name, value] : variant.headers.fields()) {
+      if (!kept(name) || !update.find(name)) {
+        headers.append_line(std::format("{}: {}", name, value));
+      }
+    }
+    for (const auto &[name, value] : update.fields()) {
+      if (kept(name)) {
+        headers.append_line(std::format("{}: {}", name, value));
+      }
+    }
+    variant.headers = std::move(headers);
+  }
+
+  // Writes the entry of `variant` again with its refreshed headers, so the
+  // next revalidation sends the new validators
+  bool refresh(const std::string_view method, const std::string_view url,
+               const Variant &variant) {
+    auto variants = _read_entry(method, url);
+    for (auto &stored : variants) {
+      if (stored.vary == variant.vary && stored.object == variant.object) {
+        stored.headers = variant.headers;
+      }
+    }
+
+    return _write_entry(method, url, variants);
+  }
+
+private:
+  static constexpr std::string_view _entry_header = "agatetepe-cache 1";
+  // Describe the stored body or the connection, not the resource
+  static constexpr std::array<std::string_view, 5> _unrefreshed_headers{
+      "Content-Length", "Content-Encoding", "Transfer-Encoding", "Connection",
+      "Keep-Alive"};
+
+  std::filesystem::path _directory;
+  // Objects are also created from the thread of started requests
+  std::atomic<size_t> _next_temporary = 0;
+
+  explicit ResponseCache(std::filesystem::path directory)
+      : _directory(std::move(directory)) {}
+
+  std::filesystem::path _objects() const { return _directory / "objects"; }
+
+  static bool _same_contents(const std::filesystem::path &a,
+                             const std::filesystem::path &b) {
+    const auto first = create_mmap_reader(a.string());
+    const auto second = create_mmap_reader(b.string());
+    return first->is_open() && second->is_open() &&
+           first->get_size() == second->get_size() &&
+           std::memcmp(first->get_data(), second->get_data(),
+                       first->get_size()) == 0;
+  }
+
+  std::filesystem::path _entry_path(const std::string_view method,
+                                    const std::string_view url) const {
+    Fnv1a hash;
+    hash.update(method);
+    hash.update(" ");
+    hash.update(url);
+    return _directory / "entries" / std::format("{:016x}", hash.value());
+  }
+
+  // Entry files are lines of `keyword rest`:
+  //
+  //   agatetepe-cache 1
+  //   GET https://example.com/catalog
+  //   variant 200 5f0c8d1e6a7b2c3d-1048576
+  //   vary Accept: application/json
+  //   header ETag: "abc"
+  //
+  // The key line guards against hash collisions between URLs.
+  std::vector<Variant> _read_entry(const std::string_view method,
+                                   const std::string_view url) const {
+    std::vector<Variant> variants;
+    const auto path = _entry_path(method, url);
+    if (!std::filesystem::exists(path)) {
+      return variants;
+    }
+
+    auto reader = create_mmap_reader(path.string());
+    if (!reader->is_open()) {
+      return variants;
+    }
+
+    const std::string_view text(reader->get_data(), reader->get_size());
+    const std::string key = std::format("{} {}", method, url);
+    size_t line_number = 0;
+
+    for (const auto range : std::views::split(text, '\n')) {
+      const std::string_view line(range.begin(), range.end());
+      line_number++;
+
+      if (line_number == 1 || line_number == 2) {
+        if (line != (line_number == 1 ? _entry_header : key)) {
+          return {};
+        }
+        continue;
+      }
+
+      const size_t space = line.find(' ');
+      const std::string_view keyword = line.substr(0, space);
+      const std::string_view rest =
+          space == std::string_view::npos ? "" : line.substr(space + 1);
+
+      if (keyword == "variant") {
+        Variant &variant = variants.emplace_back();
+        const size_t separator = rest.find(' ');
+        std::from_chars(rest.data(), rest.data() + rest.size(),
+                        variant.status_code);
+        if (separator != std::string_view::npos) {
+          variant.object = rest.substr(separator + 1);
+        }
+      } else if (variants.empty()) {
+        continue;
+      } else if (keyword == "vary") {
+        const size_t colon = rest.find(": ");
+        if (colon != std::string_view::npos) {
+          variants.back().vary.emplace_back(rest.substr(0, colon),
+                                            rest.substr(colon + 2));
+        }
+      } else if (keyword == "header") {
+        variants.back().headers.append_line(rest);
+      }
+    }
+
+    return variants;
+  }
+
+  bool _write_entry(const std::string_view method, const std::string_view url,
+                    const std::vector<Variant> &variants) {
+    std::string text = std::format("{}\n{} {}\n", _entry_header, method, url);
+    for (const auto &variant : variants) {
+      std::format_to(std::back_inserter(text), "variant {} {}\n",
+                     variant.status_code, variant.object);
+      for (const auto &[name, value] : variant.vary) {
+        std::format_to(std::back_inserter(text), "vary {}: {}\n", name, value);
+      }
+      for (const auto &[name, value] : variant.headers.fields()) {
+        std::format_to(std::back_inserter(text), "header {}: {}\n", name,
+                       value);
+      }
+    }
+
+    auto writer = create_object();
+    if (!writer || !writer->write(text)) {
+      return false;
+    }
+
+    const bool closed = std::fclose(writer->_file) == 0;
+    writer->_file = nullptr;
+
+    std::error_code error;
+    if (closed) {
+      std::filesystem::rename(writer->_path, _entry_path(method, url), error);
+    }
+    if (!closed || error) {
+      std::filesystem::remove(writer->_path, error);
+      return false;
+    }
+    return true;
+  }
+};
+
+// Destination of a response body. Adapters hand body bytes over in the
+// chunks they arrive from the network, so nothing has to hold the whole
+// payload unless the sink itself decides to.
+class ResponseSink {
+public:
+  virtual ~ResponseSink() = default;
+
+  // Called once, when the status line and headers are known and before the
+  // first body chunk (also for responses without a body).
+  virtual void on_head(const HttpResponse &head) { (void)head; }
+
+  // Returning false aborts the transfer.
+  virtual bool write(std::string_view chunk) = 0;
+};
+
+class StringSink : public ResponseSink {
+public:
+  bool write(std::string_view chunk) override {
+    _body.append(chunk);
+    return true;
+  }
+
+  std::string take() { return std::move(_body); }
+
+private:
+  std::string _body;
+};
+
+class StdoutSink : public ResponseSink {
+public:
+  bool write(std::string_view chunk) override {
+    return std::fwrite(chunk.data(), 1, chunk.size(), stdout) == chunk.size();
+  }
+};
+
+class DiscardSink : public ResponseSink {
+public:
+  bool write(std::string_view) override { return true; }
+};
+
+class FileSink : public ResponseSink {
+public:
+  ~FileSink() override {
+    if (_file) {
+      std::fclose(_file);
+    }
+  }
+
+  FileSink(const FileSink &) = delete;
+  FileSink &operator=(const FileSink &) = delete;
+
+  static std::expected<std::unique_ptr<FileSink>, AgatetepeError>
+  open(const std::filesystem::path &path) {
+    std::FILE *file = std::fopen(path.string().c_str(), "wb");
+    if (!file) {
+      return std::unexpected(AgatetepeError{
+          .code = e_agatetepe_error::io_error,
+          .message = std::format("Failed to open {} for writing: {}",
+                                 path.string(), std::strerror(errno))});
+    }
+
+    return std::unique_ptr<FileSink>(new FileSink(file, path));
+  }
+
+  bool write(std::string_view chunk) override {
+    return std::fwrite(chunk.data(), 1, chunk.size(), _file) == chunk.size();
+  }
+
+  const std::filesystem::path &path() const { return _path; }
+
+private:
+  FileSink(std::FILE *file, std::filesystem::path path)
+      : _file(file), _path(std::move(path)) {}
+
+  std::FILE *_file = nullptr;
+  std::filesystem::path _path;
+};
+
+// Keeps the body in a spool file rather than in memory, to be mapped once
+// the transfer is done. The spool is shared with whoever reads it back.
+class SpoolSink : public ResponseSink {
+public:
+  explicit SpoolSink(std::shared_ptr<SpoolFile> spool)
+      : _spool(std::move(spool)) {}
+
+  bool write(std::string_view chunk) override { return _spool->write(chunk); }
+
+private:
+  std::shared_ptr<SpoolFile> _spool;
+};
+
+// Where `>> path` / `>>! path` send the response body
+struct ResponseRedirect {
+  std::filesystem::path path;
+  // `>>!` replaces an existing file, `>>` picks a fresh name next to it
+  bool overwrite = false;
+
+  // JetBrains' behaviour for `>>`: `out.json` becomes `out-1.json`,
+  // `out-2.json` and so on until the name is free.
+  std::filesystem::path resolve() const {
+    if (overwrite || !std::filesystem::exists(path)) {
+      return path;
+    }
+
+    for (size_t suffix = 1;; suffix++) {
+      auto candidate = path;
+      candidate.replace_filename(std::format(
+          "{}-{}{}", path.stem().string(), suffix, path.extension().string()));
+
+      if (!std::filesystem::exists(candidate)) {
+        return candidate;
+      }
+    }
+  }
+
+  bool operator==(const ResponseRedirect &) const = default;
+};
+
+struct RequestHeader {
+  std::string_view key;
+  RequestTemplate value;
+
+  bool operator==(const RequestHeader &) const = default;
+};
+
+// HTTP Request structure. Like RequestTemplate, `name` and header keys view
+// the text the request was parsed from.
+class HttpRequest {
+public:
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
+  // Always one of the few known methods, short enough to never allocate
+  std::string method;
+  RequestTemplate url;
+  std::string_view name;
+  // In file order
+  std::pmr::vector<RequestHeader> headers;
+  RequestTemplate body;
+  // `< path` body, mapped and streamed from disk only when the request is sent
+  std::optional<std::filesystem::path> body_file;
+  // `# @gzip`: the body is sent gzipped, with `Content-Encoding: gzip`
+  bool gzip_body = false;
+  std::optional<ResponseRedirect> response_redirect;
+  // Unspecified lets libcurl negotiate, HTTP/2 over TLS when offered
+  HttpVersion http_version = HttpVersion::unspecified;
+
+  HttpRequest(const std::string_view method, RequestTemplate url,
+              const std::string_view name = "", allocator_type allocator = {})
+      : method(method), url(std::move(url)), name(name), headers(allocator),
+        body(allocator) {}
+
+  // A header given twice keeps the last value
+  void add_header(const std::string_view key, RequestTemplate value) {
+    for (auto &header : headers) {
+      if (header.key == key) {
+        _replace(header.value, std::move(value));
+        return;
+      }
+    }
+    headers.push_back({.key = key, .value = std::move(value)});
+  }
+
+  void set_body(RequestTemplate body) { _replace(this->body, std::move(body)); }
+
+  // Same request, parsed from the same text or not
+  bool operator==(const HttpRequest &) const = default;
+
+  // Every `{{name.response...}}` slot of the url, headers and body
+  std::vector<ResponseReference> response_references() const {
+    std::vector<ResponseReference> references;
+    auto collect = [&](const RequestTemplate &value) {
+      for (const auto &segment : value.segments()) {
+        if (segment.kind == RequestTemplate::SlotKind::response) {
+          references.push_back(segment.reference());
+        }
+      }
+    };
+
+    collect(url);
+    for (const auto &header : headers) {
+      collect(header.value);
+    }
+    collect(body);
+
+    return references;
+  }
+
+private:
+  // Move assignment keeps the allocator of the target, copying the segments
+  // over when the value was built in another arena. Constructed in place
+  // instead, the value keeps its own.
+  static void _replace(RequestTemplate &target, RequestTemplate &&value) {
+    std::destroy_at(&target);
+    std::construct_at(&target, std::move(value));
+  }
+};
+
+// Requests parsed from one source, in file order. The source text (a file
+// mapping or an owned string) stays alive with the collection, so the parsed
+// requests view it instead of copying, and whatever has to be built (header
+// arrays, template segments, joined bodies) is carved from the collection's
+// monotonic arenas rather than allocated piece by piece.
+class ParsedCollection {
+public:
+  // Where a request sits in the text, recorded by HttpRequestParser::reparse
+  // so that the next reparse can tell which requests it may reuse. A span
+  // runs from the request line to the next one, or the end of the text.
+  struct Span {
+    size_t offset = 0;
+    // ParseContext::fingerprint at the request line
+    uint64_t context = 0;
+    // `# @name` and `# @gzip` pending for the next request, the name
+    // relative to `offset`
+    uint32_t exit_name_offset = 0;
+    uint32_t exit_name_length = 0;
+    bool exit_gzip = false;
+    // Holds `@` declarations, replayed when the span is reused
+    bool declarations = false;
+    // The request was carried over from the previous parse
+    bool reused = false;
+  };
+
+  ParsedCollection() = default;
+  ParsedCollection(ParsedCollection &&) = default;
+
+  // The implicit one would free the arenas before the requests using them
+  ParsedCollection &operator=(ParsedCollection &&other) noexcept {
+    if (this != &other) {
+      _requests.clear();
+      _spans.clear();
+      _mapping = std::move(other._mapping);
+      _text = std::move(other._text);
+      _environment = std::move(other._environment);
+      _arenas = std::move(other._arenas);
+      _spans = std::move(other._spans);
+      _requests = std::move(other._requests);
+    }
+    return *this;
+  }
+
+  // Requests may also view values of `environment`, it is kept alive too
+  ParsedCollection(std::unique_ptr<MmapReader> mapping,
+                   std::shared_ptr<const Environment> environment)
+      : _mapping(std::move(mapping)), _environment(std::move(environment)) {}
+
+  ParsedCollection(std::string text,
+                   std::shared_ptr<const Environment> environment)
+      : _text(std::make_unique<std::string>(std::move(text))),
+        _environment(std::move(environment)) {}
+
+  std::string_view text() const {
+    return _mapping ? std::string_view(_mapping->get_data(),
+                                       _mapping->get_size())
+           : _text  ? std::string_view(*_text)
+                    : std::string_view();
+  }
+
+  const MmapReader *mapping() const { return _mapping.get(); }
+
+  std::span<const HttpRequest> requests() const { return _requests; }
+
+  size_t size() const { return _requests.size(); }
+
+  bool empty() const { return _requests.empty(); }
+
+  // A monotonic arena owned by the collection. Arenas aren't thread-safe,
+  // concurrent parsers get one each.
+  std::pmr::memory_resource *new_arena() {
+    return _arenas
+        .emplace_back(std::make_unique<std::pmr::monotonic_buffer_resource>())
+        .get();
+  }
+
+  void set_requests(std::vector<HttpRequest> requests) {
+    _requests = std::move(requests);
+  }
+
+  const std::shared_ptr<const Environment> &environment() const {
+    return _environment;
+  }
+
+  // One per request, empty unless built by HttpRequestParser::reparse
+  std::span<const Span> spans() const { return _spans; }
+
+  void set_spans(std::vector<Span> spans) { _spans = std::move(spans); }
+
+  // Requests carried over from an earlier parse
+  size_t reused() const {
+    return std::ranges::count_if(
+        _spans, [](const Span &span) { return span.reused; });
+  }
+
+  // Leaves the collection without requests, only its storage stays
+  std::pair<std::vector<HttpRequest>, std::vector<Span>> take_requests() {
+    return {std::exchange(_requests, {}), std::exchange(_spans, {})};
+  }
+
+private:
+  std::unique_ptr<MmapReader> _mapping;
+  std::unique_ptr<std::string> _text;
+  std::shared_ptr<const Environment> _environment;
+  std::vector<std::unique_ptr<std::pmr::monotonic_buffer_resource>> _arenas;
+  std::vector<Span> _spans;
+  // Last, so the requests are gone before the memory they point to
+  std::vector<HttpRequest> _requests;
+};
+
+// --parse-cache: parsed collections saved in a compact binary form, one
+// file per request file under $XDG_CACHE_HOME/agatetepe/parse. A saved
+// collection is used for as long as the request file keeps its size, mtime
+// and content hash, the environment its variables, and the file is parsed
+// the same way: --parse-threads resolves variables file-wide.
+//
+// Loading decodes fixed size records, nothing is parsed. Strings viewing
+// the request file are stored as offsets into it, so they view its mapping
+// again; the few others (joined bodies, environment values) live in a
+// deduplicated string table copied to the collection's arena.
+class ParseCache {
+public:
+  explicit ParseCache(std::filesystem::path directory = cache_directory() /
+                                                        "parse")
+      : _directory(std::move(directory)) {}
+
+  std::optional<ParsedCollection>
+  load(const std::string &filename,
+       std::shared_ptr<const Environment> environment,
+       const bool file_wide_variables) const {
+    std::error_code size_error;
+    std::error_code mtime_error;
+    const auto source_size = std::filesystem::file_size(filename, size_error);
+    const auto source_mtime =
+        std::filesystem::last_write_time(filename, mtime_error);
+    const auto path = _cache_path(filename);
+    if (size_error || mtime_error || !std::filesystem::exists(path)) {
+      return std::nullopt;
+    }
+
+    auto cache = create_mmap_reader(path.string());
+    if (!cache->is_open() || cache->get_size() < sizeof(Header)) {
+      return std::nullopt;
+    }
+
+    const char *data = cache->get_data();
+    const auto header = _read<Header>(data);
+    const size_t records_size = header.request_count * sizeof(RequestRecord) +
+                                header.header_count * sizeof(HeaderRecord) +
+                                header.segment_count * sizeof(SegmentRecord);
+
+    if (header.magic != _magic || header.version != _version ||
+        header.source_size != source_size ||
+        header.source_mtime != source_mtime.time_since_epoch().count() ||
+        header.environment_hash !=
+            (environment ? environment->fingerprint() : 0) ||
+        header.file_wide_variables != file_wide_variables ||
+        cache->get_size() !=
+            sizeof(Header) + records_size + header.strings_size) {
+      return std::nullopt;
+    }
+
+    // Last, it is the one check that reads the whole request file
+    auto source = create_mmap_reader(filename);
+    if (!source->is_open() || source->get_size() != source_size ||
+        _hash_contents(std::string_view(source->get_data(),
+                                        source->get_size())) !=
+            header.source_hash) {
+      return std::nullopt;
+    }
+
+    ParsedCollection collection(std::move(source), std::move(environment));
+    std::pmr::memory_resource *arena = collection.new_arena();
+
+    char *strings = static_cast<char *>(arena->allocate(
+        std::max<size_t>(header.strings_size, 1), alignof(char)));
+    std::memcpy(strings, data + sizeof(Header) + records_size,
+                header.strings_size);
+
+    const Tables tables{
+        .text = collection.text(),
+        .strings = std::string_view(strings, header.strings_size)};
+
+    if (tables.view(header.filename) != filename) {
+      return std::nullopt;
+    }
+
+    const char *request_records = data + sizeof(Header);
+    const char *header_records =
+        request_records + header.request_count * sizeof(RequestRecord);
+    const char *segment_records =
+        header_records + header.header_count * sizeof(HeaderRecord);
+
+    std::vector<RequestTemplate::Segment> segments;
+    auto restore = [&](const TemplateRecord &record)
+        -> std::optional<RequestTemplate> {
+      if (uint64_t{record.first_segment} + record.segment_count >
+          header.segment_count) {
+        return std::nullopt;
+      }
+
+      segments.clear();
+      for (uint32_t i = 0; i < record.segment_count; i++) {
+        const auto segment = _read<SegmentRecord>(
+            segment_records + (record.first_segment + i) * sizeof(SegmentRecord));
+        const auto text = tables.view(segment.text);
+        if (!text || segment.kind > static_cast<uint32_t>(
+                                        RequestTemplate::SlotKind::response)) {
+          return std::nullopt;
+        }
+
+        segments.push_back(
+            {.kind = static_cast<RequestTemplate::SlotKind>(segment.kind),
+             .text = *text,
+             .compiled = {}});
+      }
+
+      return RequestTemplate::restore(segments, arena);
+    };
+
+    std::vector<HttpRequest> requests;
+    requests.reserve(header.request_count);
+
+    for (uint64_t i = 0; i < header.request_count; i++) {
+      const auto record =
+          _read<RequestRecord>(request_records + i * sizeof(RequestRecord));
+
+      const auto method = tables.view(record.method);
+      const auto name = tables.view(record.name);
+      auto url = restore(record.url);
+      auto body = restore(record.body);
+      const auto body_file = tables.view(record.body_file);
+      const auto redirect = tables.view(record.redirect);
+      if (!method || !name || !url || !body || !body_file || !redirect ||
+          uint64_t{record.first_header} + record.header_count >
+              header.header_count) {
+        return std::nullopt;
+      }
+
+      HttpRequest &request =
+          requests.emplace_back(*method, std::move(*url), *name, arena);
+      request.headers.reserve(record.header_count);
+
+      for (uint32_t j = 0; j < record.header_count; j++) {
+        const auto header_record = _read<HeaderRecord>(
+            header_records + (record.first_header + j) * sizeof(HeaderRecord));
+        const auto key = tables.view(header_record.key);
+        auto value = restore(header_record.value);
+        if (!key || !value) {
+          return std::nullopt;
+        }
+        request.headers.push_back({.key = *key, .value = std::move(*value)});
+      }
+
+      request.set_body(std::move(*body));
+      if (record.flags & _has_body_file) {
+        request.body_file = std::filesystem::path(*body_file);
+      }
+      request.gzip_body = record.flags & _gzip_body;
+      if (record.flags & _has_redirect) {
+        request.response_redirect = ResponseRedirect{
+            .path = std::filesystem::path(*redirect),
+            .overwrite = (record.flags & _overwrite) != 0};
+      }
+      request.http_version = static_cast<HttpVersion>(record.http_version);
+    }
+
+    collection.set_requests(std::move(requests));
+    return collection;
+  }
+
+  // Best effort, a cache that can't be written is just not used
+  void store(const std::string &filename, const ParsedCollection &collection,
+             const std::shared_ptr<const Environment> &environment,
+             const bool file_wide_variables) const {
+    std::error_code error;
+    const auto source_mtime = std::filesystem::last_write_time(filename, error);
+    if (error) {
+      return;
+    }
+
+    std::filesystem::create_directories(_directory, error);
+    if (error) {
+      return;
+    }
+
+    // Offsets and counts are 32 bits wide
+    if (collection.text().size() > _max_size) {
+      return;
+    }
+
+    Writer writer(collection.text());
+    std::vector<RequestRecord> requests;
+    requests.reserve(collection.size());
+
+    for (const HttpRequest &request : collection.requests()) {
+      RequestRecord record{};
+      record.method = writer.reference(request.method);
+      record.name = writer.reference(request.name);
+      record.url = writer.add(request.url);
+      record.body = writer.add(request.body);
+      record.first_header = static_cast<uint32_t>(writer.headers.size());
+      record.header_count = static_cast<uint32_t>(request.headers.size());
+      for (const auto &[key, value] : request.headers) {
+        writer.headers.push_back(
+            {.key = writer.reference(key), .value = writer.add(value)});
+      }
+
+      if (request.body_file) {
+        record.flags |= _has_body_file;
+        record.body_file = writer.copy(request.body_file->string());
+      }
+      if (request.gzip_body) {
+        record.flags |= _gzip_body;
+      }
+      if (request.response_redirect) {
+        record.flags |= _has_redirect;
+        record.redirect = writer.copy(request.response_redirect->path.string());
+        if (request.response_redirect->overwrite) {
+          record.flags |= _overwrite;
+        }
+      }
+      record.http_version = static_cast<uint32_t>(request.http_version);
+
+      requests.push_back(record);
+    }
+
+    Header header{};
+    header.magic = _magic;
+    header.version = _version;
+    header.request_count = requests.size();
+    header.header_count = writer.headers.size();
+    header.segment_count = writer.segments.size();
+    header.source_size = collection.text().size();
+    header.source_mtime = source_mtime.time_since_epoch().count();
+    header.source_hash = _hash_contents(collection.text());
+    header.environment_hash = environment ? environment->fingerprint() : 0;
+    header.file_wide_variables = file_wide_variables;
+    header.filename = writer.copy(filename);
+    header.strings_size = writer.strings.size();
+
+    if (writer.strings.size() > _max_size ||
+        writer.segments.size() > _max_size ||
+        writer.headers.size() > _max_size) {
+      return;
+    }
+
+    // Written aside and renamed over, concurrent runs only ever see a
+    // whole file
+    const auto path = _cache_path(filename);
+    auto temporary = path;
+    temporary += std::format(
+        ".tmp-{:x}", std::chrono::system_clock::now().time_since_epoch().count());
+
+    std::FILE *file = std::fopen(temporary.string().c_str(), "wbx");
+    if (!file) {
+      return;
+    }
+
+    auto write = [file](const void *data, const size_t size) {
+      return size == 0 || std::fwrite(data, 1, size, file) == size;
+    };
+
+    const bool written =
+        write(&header, sizeof(header)) &&
+        write(requests.data(), requests.size() * sizeof(RequestRecord)) &&
+        write(writer.headers.data(),
+              writer.headers.size() * sizeof(HeaderRecord)) &&
+        write(writer.segments.data(),
+              writer.segments.size() * sizeof(SegmentRecord)) &&
+        write(writer.strings.data(), writer.strings.size());
+
+    if (std::fclose(file) != 0 || !written) {
+      std::filesystem::remove(temporary, error);
+      return;
+    }
+
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+      std::filesystem::remove(temporary, error);
+    }
+  }
+
+private:
+  static constexpr std::array<char, 8> _magic = {'A', 'G', 'T', 'P',
+                                                 'A', 'R', 'S', 'E'};
+  // Bumped whenever a record changes
+  static constexpr uint32_t _version = 3;
+
+  // Of the request file, the string table and the record tables
+  static constexpr size_t _max_size = 0x7fffffff;
+
+  static constexpr uint32_t _has_body_file = 1;
+  static constexpr uint32_t _gzip_body = 2;
+  static constexpr uint32_t _has_redirect = 4;
+  static constexpr uint32_t _overwrite = 8;
+
+  // Bytes of the request file, or of the string table when the top bit of
+  // `length` is set
+  struct StringRef {
+    static constexpr uint32_t in_strings = 0x80000000;
+
+    uint32_t offset = 0;
+    uint32_t length = 0;
+  };
+
+  struct TemplateRecord {
+    uint32_t first_segment = 0;
+    uint32_t segment_count = 0;
+  };
+
+  // Dynamic and response slots are compiled again from their text
+  struct SegmentRecord {
+    StringRef text;
+    uint32_t kind = 0;
+  };
+
+  struct HeaderRecord {
+    StringRef key;
+    TemplateRecord value;
+  };
+
+  struct RequestRecord {
+    StringRef method;
+    StringRef name;
+    TemplateRecord url;
+    TemplateRecord body;
+    uint32_t first_header = 0;
+    uint32_t header_count = 0;
+    StringRef body_file;
+    StringRef redirect;
+    uint32_t flags = 0;
+    uint32_t http_version = 0;
+  };
+
+  // Followed by the request, header and segment records, then the strings
+  struct Header {
+    std::array<char, 8> magic{};
+    uint32_t version = 0;
+    uint32_t file_wide_variables = 0;
+    uint64_t request_count = 0;
+    uint64_t header_count = 0;
+    uint64_t segment_count = 0;
+    uint64_t strings_size = 0;
+    uint64_t source_size = 0;
+    int64_t source_mtime = 0;
+    uint64_t source_hash = 0;
+    uint64_t environment_hash = 0;
+    StringRef filename;
+  };
+
+  struct Tables {
+    std::string_view text;
+    std::string_view strings;
+
+    // Null when the reference points out of its table
+    std::optional<std::string_view> view(const StringRef &reference) const {
+      const std::string_view table =
+          reference.length & StringRef::in_strings ? strings : text;
+      const uint32_t length = reference.length & ~StringRef::in_strings;
+      if (reference.offset > table.size() ||
+          length > table.size() - reference.offset) {
+        return std::nullopt;
+      }
+      return table.substr(reference.offset, length);
+    }
+  };
+
+  struct Writer {
+    std::string_view text;
+    std::vector<HeaderRecord> headers;
+    std::vector<SegmentRecord> segments;
+    std::string strings;
+    std::unordered_map<std::string_view, uint32_t, StringHash, std::equal_to<>>
+        copied;
+
+    explicit Writer(const std::string_view text) : text(text) {}
+
+    // Views into the request file become offsets, anything else a copy
+    StringRef reference(const std::string_view value) {
+      if (value.empty()) {
+        return {};
+      }
+      if (std::less_equal<>()(text.data(), value.data()) &&
+          std::less_equal<>()(value.data() + value.size(),
+                              text.data() + text.size())) {
+        return {.offset = static_cast<uint32_t>(value.data() - text.data()),
+                .length = static_cast<uint32_t>(value.size())};
+      }
+      return copy(value);
+    }
+
+    // Into the string table, once per distinct value. The keys view the
+    // collection, which outlives the writer.
+    StringRef copy(const std::string_view value) {
+      auto [it, inserted] =
+          copied.try_emplace(value, static_cast<uint32_t>(strings.size()));
+      if (inserted) {
+        strings += value;
+      }
+      return {.offset = it->second,
+              .length = static_cast<uint32_t>(value.size()) |
+                        StringRef::in_strings};
+    }
+
+    TemplateRecord add(const RequestTemplate &value) {
+      const TemplateRecord record{
+          .first_segment = static_cast<uint32_t>(segments.size()),
+          .segment_count = static_cast<uint32_t>(value.segments().size())};
+      for (const auto &segment : value.segments()) {
+        segments.push_back({.text = reference(segment.text),
+                            .kind = static_cast<uint32_t>(segment.kind)});
+      }
+      return record;
+    }
+  };
+
+  std::filesystem::path _directory;
+
+  // One cache file per absolute request file path
+  std::filesystem::path _cache_path(const std::string &filename) const {
+    Fnv1a hash;
+    hash.update(std::filesystem::absolute(filename).lexically_normal().string());
+    return _directory / std::format("{:016x}.bin", hash.value());
+  }
+
+  template <typename Record> static Record _read(const char *data) {
+    Record record;
+    std::memcpy(&record, data, sizeof(Record));
+    return record;
+  }
+
+  // A word at a time: validating must stay well under the cost of parsing
+  static uint64_t _hash_contents(const std::string_view text) {
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ text.size();
+    size_t i = 0;
+
+    for (; i + 8 <= text.size(); i += 8) {
+      uint64_t word;
+      std::memcpy(&word, text.data() + i, 8);
+      hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+      hash ^= hash >> 32;
+    }
+
+    Fnv1a tail;
+    tail.update(text.substr(i));
+    return hash ^ tail.value();
+  }
+};
+
+using RequestResult = std::expected<HttpResponse, AgatetepeError>;
+
+// Receives the position (within the submitted batch) and the outcome of a
+// finished request.
+using CompletionHandler = std::function<void(size_t, RequestResult)>;
+
+// Picks the body destination of each request of a batch; a null sink keeps
+// the body in HttpResponse::body.
+using SinkFactory = std::function<std::unique_ptr<ResponseSink>(size_t)>;
+
+// A request started with RequestAdapter::start_request. The transfer runs on
+// the adapter's thread, which only updates the progress; the result is set
+// by RequestAdapter::collect, on the thread that started the request.
+class BackgroundRequest {
+public:
+  struct Progress {
+    uint64_t downloaded = 0;
+    // Zero while unknown, like for a chunked response
+    uint64_t download_size = 0;
+    uint64_t uploaded = 0;
+    uint64_t upload_size = 0;
+  };
+
+  Progress progress() const {
+    return {.downloaded = _downloaded.load(std::memory_order_relaxed),
+            .download_size = _download_size.load(std::memory_order_relaxed),
+            .uploaded = _uploaded.load(std::memory_order_relaxed),
+            .upload_size = _upload_size.load(std::memory_order_relaxed)};
+  }
+
+  // From curl's progress callback
+  void set_progress(const Progress &progress) {
+    _downloaded.store(progress.downloaded, std::memory_order_relaxed);
+    _download_size.store(progress.download_size, std::memory_order_relaxed);
+    _uploaded.store(progress.uploaded, std::memory_order_relaxed);
+    _upload_size.store(progress.upload_size, std::memory_order_relaxed);
+  }
+
+  // Up to now, or until the request was done
+  std::chrono::steady_clock::duration elapsed() const {
+    return (_result ? _finished_at : std::chrono::steady_clock::now()) -
+           _started_at;
+  }
+
+  // The transfer is aborted the next time the adapter's thread looks at it,
+  // and fails with e_agatetepe_error::cancelled
+  void cancel() { _cancelled.store(true, std::memory_order_relaxed); }
+
+  bool cancelled() const { return _cancelled.load(std::memory_order_relaxed); }
+
+  bool done() const { return _result.has_value(); }
+
+  // Once done
+  const RequestResult &result() const { return *_result; }
+
+  void finish(RequestResult result) {
+    _result = std::move(result);
+    _finished_at = std::chrono::steady_clock::now();
+  }
+
+private:
+  std::atomic<uint64_t> _downloaded = 0;
+  std::atomic<uint64_t> _download_size = 0;
+  std::atomic<uint64_t> _uploaded = 0;
+  std::atomic<uint64_t> _upload_size = 0;
+  std::atomic<bool> _cancelled = false;
+  std::chrono::steady_clock::time_point _started_at =
+      std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point _finished_at;
+  std::optional<RequestResult> _result;
+};
+
+// Abstract adapter for request engines
+class RequestAdapter {
+public:
+  virtual ~RequestAdapter() = default;
+
+  // Where `{{name.response...}}` slots are read from. Responses to the
+  // requests it tracks are stored into it as they complete.
+  void set_response_store(ResponseStore *responses) { _responses = responses; }
+
+  // --cache: GET responses are stored in and revalidated against `cache`
+  void set_response_cache(ResponseCache *cache) { _cache = cache; }
+
+  // Streams the response body into `sink`, HttpResponse::body stays empty
+  virtual std::expected<HttpResponse, AgatetepeError>
+  stream_request(const HttpRequest &request, ResponseSink &sink) = 0;
+
+  // Buffers the whole response body into HttpResponse::body
+  std::expected<HttpResponse, AgatetepeError>
+  do_request(const HttpRequest &request) {
+    StringSink sink;
+    auto response = stream_request(request, sink);
+
+    if (response.has_value()) {
+      response->body = sink.take();
+    }
+
+    return response;
+  }
+
+  // Starts `request` without waiting for it; its body goes to `sink`, or is
+  // buffered into HttpResponse::body without one. Engines without
+  // background transfers run it before returning.
+  virtual std::shared_ptr<BackgroundRequest>
+  start_request(const HttpRequest &request,
+                std::unique_ptr<ResponseSink> sink = nullptr) {
+    auto started = std::make_shared<BackgroundRequest>();
+    if (sink) {
+      started->finish(stream_request(request, *sink));
+    } else {
+      started->finish(do_request(request));
+    }
+    return started;
+  }
+
+  // Finishes the started requests whose transfers completed since the last
+  // call. The response store and cache are updated here, on the calling
+  // thread, like for the other requests.
+  virtual void collect() {}
+
+  // Opens up to `connections` connections to each origin `requests` talk to
+  // and leaves them idle, so a timed run starts on warm connections. Returns
+  // how many were opened. Engines without a connection cache have nothing to
+  // warm.
+  virtual size_t warm_up(std::span<const HttpRequest *const> requests,
+                         size_t connections) {
+    (void)requests;
+    (void)connections;
+    return 0;
+  }
+
+  // Runs a batch with at most `parallel` requests in flight. Completions are
+  // reported as they happen, which is not necessarily the batch order.
+  // Engines without concurrency support fall back to one at a time.
+  virtual void do_requests(std::span<const HttpRequest *const> requests,
+                           size_t parallel, const SinkFactory &make_sink,
+                           const CompletionHandler &on_complete) {
+    (void)parallel;
+    for (size_t i = 0; i < requests.size(); i++) {
+      if (auto sink = make_sink ? make_sink(i) : nullptr) {
+        on_complete(i, stream_request(*requests[i], *sink));
+      } else {
+        on_complete(i, do_request(*requests[i]));
+      }
+    }
+  }
+
+protected:
+  ResponseStore *_responses = nullptr;
+  ResponseCache *_cache = nullptr;
+};
+
+// Streaming gzip encoder for request bodies. zlib's state weighs a few
+// hundred KiB, so transfers reset and reuse it instead of rebuilding it for
+// every request.
+class GzipEncoder {
+public:
+  GzipEncoder() {
+    // 15 bits of window, +16 for the gzip wrapper instead of zlib's
+    _initialised = deflateInit2(&_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                                15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+  }
+
+  ~GzipEncoder() {
+    if (_initialised) {
+      deflateEnd(&_stream);
+    }
+  }
+
+  GzipEncoder(const GzipEncoder &) = delete;
+  GzipEncoder &operator=(const GzipEncoder &) = delete;
+
+  void reset() {
+    if (_initialised) {
+      deflateReset(&_stream);
+    }
+    _finished = false;
+  }
+
+  // Compresses `input` into `output`, returning how many bytes of each were
+  // used. `input` must be the whole rest of the body; once it is consumed the
+  // gzip trailer is written and finished() turns true. Fails when zlib
+  // couldn't be set up or makes no progress, rather than returning nothing
+  // forever.
+  std::expected<std::pair<size_t, size_t>, AgatetepeError>
+  encode(const std::string_view input, const std::span<char> output) {
+    if (!_initialised) {
+      return std::unexpected(
+          AgatetepeError{.code = e_agatetepe_error::unknown,
+                         .message = "Failed to initialise the gzip encoder."});
+    }
+
+    _stream.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    _stream.avail_in =
+        static_cast<uInt>(std::min<size_t>(input.size(), UINT_MAX));
+    _stream.next_out = reinterpret_cast<Bytef *>(output.data());
+    _stream.avail_out =
+        static_cast<uInt>(std::min<size_t>(output.size(), UINT_MAX));
+
+    const size_t available_in = _stream.avail_in;
+    const size_t available_out = _stream.avail_out;
+    const int flush = available_in == input.size() ? Z_FINISH : Z_NO_FLUSH;
+
+    const int status = deflate(&_stream, flush);
+    if (status != Z_OK && status != Z_STREAM_END) {
+      return std::unexpected(AgatetepeError{
+          .code = e_agatetepe_error::unknown,
+          .message = std::format("Failed to gzip the request body: {}",
+                                 _stream.msg ? _stream.msg : zError(status))});
+    }
+    _finished = status == Z_STREAM_END;
+
+    return std::pair(available_in - _stream.avail_in,
+                     available_out - _stream.avail_out);
+  }
+
+  // The whole of `input` at once, into `out`
+  std::expected<void, AgatetepeError> encode_all(const std::string_view input,
+                                                 std::string &out) {
+    reset();
+    out.resize(_initialised ? deflateBound(&_stream, input.size()) : 0);
+    const auto encoded = encode(input, out);
+    if (!encoded) {
+      return std::unexpected(encoded.error());
+    }
+    // deflateBound leaves room for everything, trailer included
+    if (!_finished) {
+      return std::unexpected(AgatetepeError{
+          .code = e_agatetepe_error::unknown,
+          .message = "Failed to gzip the request body: output overflow."});
+    }
+    out.resize(encoded->second);
+    return {};
+  }
+
+  bool finished() const { return _finished; }
+
+private:
+  z_stream _stream{};
+  bool _initialised = false;
+  bool _finished = false;
+};
+
+// cURL adapter implementation
+//
+// Easy handles are pooled per origin (scheme://host:port) and every handle is
+// attached to a single CURLSH, so DNS answers, keep-alive connections and TLS
+// sessions survive across requests made through the same adapter.
+class CurlAdapter : public RequestAdapter {
+public:
+  // `resolve` entries are `host:port:addr` overrides in CURLOPT_RESOLVE
+  // syntax, applied to every transfer ahead of DNS
+  explicit CurlAdapter(const std::vector<std::string> &resolve = {}) {
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+      throw std::runtime_error("Failed to initialise libcurl");
+    }
+
+    _share = curl_share_init();
+    if (!_share) {
+      curl_global_cleanup();
+      throw std::runtime_error("Failed to initialise cURL share handle");
+    }
+
+    curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    // Started requests use the share from the transfer thread
+    curl_share_setopt(_share, CURLSHOPT_LOCKFUNC, _lock_share);
+    curl_share_setopt(_share, CURLSHOPT_UNLOCKFUNC, _unlock_share);
+    curl_share_setopt(_share, CURLSHOPT_USERDATA, &_share_locks);
+
+    for (const auto &entry : resolve) {
+      _resolve = curl_slist_append(_resolve, entry.c_str());
+    }
+  }
+
+  ~CurlAdapter() override {
+    // Easy handles must go before the share they are attached to, those of
+    // unfinished started requests included
+    if (_transfer_thread) {
+      for (auto &transfer : _transfer_thread->stop()) {
+        _discard_transfer(*transfer);
+      }
+      _transfer_thread.reset();
+    }
+
+    for (auto &[origin, handles] : _idle_handles) {
+      for (CURL *handle : handles) {
+        curl_easy_cleanup(handle);
+      }
+    }
+
+    curl_share_cleanup(_share);
+    curl_slist_free_all(_resolve);
+    curl_global_cleanup();
+  }
+
+  CurlAdapter(const CurlAdapter &) = delete;
+  CurlAdapter &operator=(const CurlAdapter &) = delete;
+
+  std::expected<HttpResponse, AgatetepeError>
+  stream_request(const HttpRequest &request, ResponseSink &sink) override {
+    auto transfer = _acquire_transfer();
+    transfer->sink = &sink;
+
+    RequestResult result;
+    if (auto prepared = _prepare_transfer(*transfer, request); !prepared) {
+      result = std::unexpected(prepared.error());
+    } else {
+      // Perform the request
+      CURLcode res = curl_easy_perform(transfer->curl);
+      result = _finish_transfer(*transfer, res);
+    }
+
+    _release_transfer(std::move(transfer));
+    return result;
+  }
+
+  // The transfer is handed to the transfer thread, started on first use
+  std::shared_ptr<BackgroundRequest>
+  start_request(const HttpRequest &request,
+                std::unique_ptr<ResponseSink> sink) override {
+    auto started = std::make_shared<BackgroundRequest>();
+    if (!_transfer_thread) {
+      _transfer_thread = TransferThread::create();
+    }
+    if (!_transfer_thread) {
+      started->finish(std::unexpected(AgatetepeError{
+          .code = e_agatetepe_error::curl_error,
+          .message = "Failed to initialise cURL multi handler."}));
+      return started;
+    }
+
+    auto transfer = _acquire_transfer();
+    transfer->owned_sink = std::move(sink);
+    transfer->sink = transfer->owned_sink.get();
+
+    if (auto prepared = _prepare_transfer(*transfer, request); !prepared) {
+      _release_transfer(std::move(transfer));
+      started->finish(std::unexpected(prepared.error()));
+      return started;
+    }
+
+    transfer->started = started;
+    CURL *curl = transfer->curl;
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer.get());
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, _curl_progress_callback);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, transfer.get());
+
+    _transfer_thread->submit(std::move(transfer));
+    return started;
+  }
+
+  void collect() override {
+    if (!_transfer_thread) {
+      return;
+    }
+
+    for (auto &[transfer, res] : _transfer_thread->take_completed()) {
+      auto started = std::move(transfer->started);
+      if (res != CURLE_OK && started->cancelled()) {
+        _discard_transfer(*transfer);
+        started->finish(std::unexpected(
+            AgatetepeError{.code = e_agatetepe_error::cancelled,
+                           .message = "Cancelled."}));
+      } else {
+        started->finish(_finish_transfer(*transfer, res));
+      }
+      _release_transfer(std::move(transfer));
+    }
+  }
+
+  // Each connection is opened by an `OPTIONS *` request rather than
+  // CURLOPT_CONNECT_ONLY, whose connections libcurl never hands to other
+  // transfers. Origins get no more connections than they have requests, and
+  // a single one when they multiplex.
+  size_t warm_up(std::span<const HttpRequest *const> requests,
+                 size_t connections) override {
+    std::map<std::string, WarmUpTarget> targets;
+    std::string url;
+    for (const HttpRequest *request : requests) {
+      url.clear();
+      request->url.render_into(url, _responses);
+      auto [it, inserted] = targets.try_emplace(_origin_of(url));
+      if (inserted) {
+        it->second.version = request->http_version;
+      }
+      it->second.requests++;
+    }
+
+    // A first connection per origin tells which of them multiplex
+    for (auto &[origin, target] : targets) {
+      target.connections = 1;
+    }
+    size_t opened = _open_connections(targets);
+
+    for (auto &[origin, target] : targets) {
+      target.connections =
+          target.multiplexed
+              ? 0
+              : std::min(target.requests, std::max<size_t>(connections, 1)) -
+                    1;
+    }
+    opened += _open_connections(targets);
+
+    return opened;
+  }
+
+  void do_requests(std::span<const HttpRequest *const> requests,
+                   size_t parallel, const SinkFactory &make_sink,
+                   const CompletionHandler &on_complete) override {
+    CURLM *multi = curl_multi_init();
+    if (!multi) {
+      for (size_t i = 0; i < requests.size(); i++) {
+        on_complete(i, std::unexpected(AgatetepeError{
+                           .code = e_agatetepe_error::curl_error,
+                           .message = "Failed to initialise cURL multi handler."}));
+      }
+      return;
+    }
+
+    // Transfers to the same HTTP/2 (or 3) origin share one connection
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    parallel = std::max<size_t>(parallel, 1);
+
+    std::vector<std::unique_ptr<Transfer>> in_flight;
+    in_flight.reserve(parallel);
+    size_t next = 0;
+
+    // Keeps the pipeline full: whenever a slot frees up, the next request in
+    // batch order takes it.
+    auto fill_slots = [&] {
+      while (in_flight.size() < parallel && next < requests.size()) {
+        auto transfer = _acquire_transfer();
+        transfer->index = next++;
+        transfer->owned_sink = make_sink ? make_sink(transfer->index) : nullptr;
+        transfer->sink = transfer->owned_sink.get();
+
+        if (auto prepared = _prepare_transfer(*transfer,
+                                              *requests[transfer->index]);
+            !prepared) {
+          const size_t index = transfer->index;
+          _release_transfer(std::move(transfer));
+          on_complete(index, std::unexpected(prepared.error()));
+          continue;
+        }
+
+        curl_easy_setopt(transfer->curl, CURLOPT_PRIVATE, transfer.get());
+        curl_multi_add_handle(multi, transfer->curl);
+        in_flight.push_back(std::move(transfer));
+      }
+    };
+
+    fill_slots();
+
+    while (!in_flight.empty()) {
+      int still_running = 0;
+      CURLMcode multi_code = curl_multi_perform(multi, &still_running);
+
+      if (multi_code == CURLM_OK) {
+        int queued = 0;
+        while (CURLMsg *message = curl_multi_info_read(multi, &queued)) {
+          if (message->msg != CURLMSG_DONE) {
+            continue;
+          }
+
+          Transfer *done = nullptr;
+          curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &done);
+          CURLcode res = message->data.result;
+          curl_multi_remove_handle(multi, done->curl);
+
+          auto owned = std::ranges::find(
+              in_flight, done, &std::unique_ptr<Transfer>::get);
+          std::unique_ptr<Transfer> transfer = std::move(*owned);
+          in_flight.erase(owned);
+
+          const size_t index = transfer->index;
+          auto result = _finish_transfer(*transfer, res);
+          _release_transfer(std::move(transfer));
+          on_complete(index, std::move(result));
+        }
+
+        fill_slots();
+      }
+
+      if (multi_code == CURLM_OK && !in_flight.empty()) {
+        multi_code = curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+      }
+
+      if (multi_code != CURLM_OK) {
+        // The multi stack is unusable, fail whatever is left of the batch
+        const std::string message = std::format(
+            "curl_multi failed: {}", curl_multi_strerror(multi_code));
+
+        for (auto &transfer : in_flight) {
+          curl_multi_remove_handle(multi, transfer->curl);
+          _discard_transfer(*transfer);
+          const size_t index = transfer->index;
+          _release_transfer(std::move(transfer));
+          on_complete(index, std::unexpected(AgatetepeError{
+                                 .code = e_agatetepe_error::curl_error,
+                                 .message = message}));
+        }
+        in_flight.clear();
+
+        for (; next < requests.size(); next++) {
+          on_complete(next, std::unexpected(AgatetepeError{
+                                .code = e_agatetepe_error::curl_error,
+                                .message = message}));
+        }
+      }
+    }
+
+    curl_multi_cleanup(multi);
+  }
+
+private:
+  // Per-request state; callbacks keep pointers into it, so it must stay put
+  // until the transfer is finished.
+  struct Transfer {
+    size_t index = 0;
+    CURL *curl = nullptr;
+    std::string origin;
+    struct curl_slist *headers_list = nullptr;
+    // Body destination, the body is buffered into `response` when null
+    ResponseSink *sink = nullptr;
+    std::unique_ptr<ResponseSink> owned_sink;
+    bool head_sent = false;
+    HttpResponse response;
+    // Memory-mapped `< path` request body and how much of it curl has read
+    std::unique_ptr<MmapReader> upload;
+    size_t upload_offset = 0;
+    size_t upload_released = 0;
+    // Gzip encoding of the request body, `< path` uploads are encoded on the
+    // fly as curl reads them
+    std::unique_ptr<GzipEncoder> encoder;
+    bool encode_upload = false;
+    // Why the read callback aborted the upload
+    std::optional<AgatetepeError> upload_error;
+    // `# @name` of a request whose response the store tracks, the body is
+    // kept aside for it when it goes to a sink
+    std::string capture_as;
+    std::string captured;
+    // --cache, for GET requests: the variant being revalidated, the body on
+    // its way into the cache, or the cached body answering a 304
+    ResponseCache *cache = nullptr;
+    std::optional<ResponseCache::Variant> cached;
+    std::unique_ptr<ResponseCache::ObjectWriter> cache_writer;
+    std::unique_ptr<MmapReader> cache_object;
+    // Render buffers, their capacity survives when the transfer is recycled
+    std::string url;
+    std::string body;
+    std::string encoded_body;
+    std::string header_line;
+    // Set for start_request, progress goes there
+    std::shared_ptr<BackgroundRequest> started;
+
+    // Back to a blank transfer, minus the buffer allocations
+    void reset() {
+      index = 0;
+      curl = nullptr;
+      origin.clear();
+      headers_list = nullptr;
+      sink = nullptr;
+      owned_sink.reset();
+      head_sent = false;
+      response = HttpResponse{};
+      upload.reset();
+      upload_offset = 0;
+      upload_released = 0;
+      encode_upload = false;
+      upload_error.reset();
+      capture_as.clear();
+      // Captured bodies can be large, their memory is not worth keeping
+      std::string().swap(captured);
+      cache = nullptr;
+      cached.reset();
+      cache_writer.reset();
+      cache_object.reset();
+      url.clear();
+      body.clear();
+      encoded_body.clear();
+      header_line.clear();
+      started.reset();
+    }
+  };
+
+  // Runs the transfers of start_request on a thread of its own, over its
+  // own multi handle. A transfer belongs to the thread from submit() until
+  // it comes back out of take_completed(), the adapter doesn't touch it in
+  // between.
+  class TransferThread {
+  public:
+    struct Completed {
+      std::unique_ptr<Transfer> transfer;
+      CURLcode result = CURLE_OK;
+    };
+
+    static std::unique_ptr<TransferThread> create() {
+      CURLM *multi = curl_multi_init();
+      if (!multi) {
+        return nullptr;
+      }
+      return std::unique_ptr<TransferThread>(new TransferThread(multi));
+    }
+
+    ~TransferThread() {
+      stop();
+      curl_multi_cleanup(_multi);
+    }
+
+    TransferThread(const TransferThread &) = delete;
+    TransferThread &operator=(const TransferThread &) = delete;
+
+    void submit(std::unique_ptr<Transfer> transfer) {
+      {
+        std::lock_guard lock(_mutex);
+        _submitted.push_back(std::move(transfer));
+      }
+      curl_multi_wakeup(_multi);
+    }
+
+    std::vector<Completed> take_completed() {
+      std::lock_guard lock(_mutex);
+      return std::exchange(_completed, {});
+    }
+
+    // Joins the thread, handing back every transfer it still had
+    std::vector<std::unique_ptr<Transfer>> stop() {
+      if (_thread.joinable()) {
+        {
+          std::lock_guard lock(_mutex);
+          _stopping = true;
+        }
+        curl_multi_wakeup(_multi);
+        _thread.join();
+      }
+
+      std::vector<std::unique_ptr<Transfer>> left = std::move(_running);
+      _running.clear();
+      for (auto &transfer : left) {
+        curl_multi_remove_handle(_multi, transfer->curl);
+      }
+      std::ranges::move(_submitted, std::back_inserter(left));
+      _submitted.clear();
+      for (auto &completed : _completed) {
+        left.push_back(std::move(completed.transfer));
+      }
+      _completed.clear();
+      return left;
+    }
+
+  private:
+    // How often cancellations are looked for while transfers are idle
+    static constexpr int _cancel_check_interval = 100; // ms
+
+    CURLM *_multi;
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<Transfer>> _submitted;
+    std::vector<Completed> _completed;
+    bool _stopping = false;
+    // Only touched by the thread while it runs
+    std::vector<std::unique_ptr<Transfer>> _running;
+    std::thread _thread;
+
+    explicit TransferThread(CURLM *multi) : _multi(multi) {
+      // Transfers to the same HTTP/2 (or 3) origin share one connection
+      curl_multi_setopt(_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+      _thread = std::thread([this] { _run(); });
+    }
+
+    void _complete(std::unique_ptr<Transfer> transfer, const CURLcode result) {
+      curl_multi_remove_handle(_multi, transfer->curl);
+      std::lock_guard lock(_mutex);
+      _completed.push_back({.transfer = std::move(transfer), .result = result});
+    }
+
+    void _run() {
+      while (true) {
+        {
+          std::lock_guard lock(_mutex);
+          if (_stopping) {
+            return;
+          }
+          for (auto &transfer : _submitted) {
+            curl_multi_add_handle(_multi, transfer->curl);
+            _running.push_back(std::move(transfer));
+          }
+          _submitted.clear();
+        }
+
+        // The progress callback aborts cancelled transfers that are moving,
+        // this catches those waiting on a silent server
+        for (auto it = _running.begin(); it != _running.end();) {
+          if ((*it)->started->cancelled()) {
+            _complete(std::move(*it), CURLE_ABORTED_BY_CALLBACK);
+            it = _running.erase(it);
+          } else {
+            ++it;
+          }
+        }
+
+        int still_running = 0;
+        curl_multi_perform(_multi, &still_running);
+
+        int queued = 0;
+        while (CURLMsg *message = curl_multi_info_read(_multi, &queued)) {
+          if (message->msg != CURLMSG_DONE) {
+            continue;
+          }
+
+          Transfer *done = nullptr;
+          curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &done);
+          const CURLcode result = message->data.result;
+          auto owned = std::ranges::find(_running, done,
+                                         &std::unique_ptr<Transfer>::get);
+          _complete(std::move(*owned), result);
+          _running.erase(owned);
+        }
+
+        // Woken up early by submit() and stop()
+        curl_multi_poll(_multi, nullptr, 0,
+                        _running.empty() ? 1000 : _cancel_check_interval,
+                        nullptr);
+      }
+    }
+  };
+
+  std::unique_ptr<Transfer> _acquire_transfer() {
+    if (_spare_transfers.empty()) {
+      return std::make_unique<Transfer>();
+    }
+
+    auto transfer = std::move(_spare_transfers.back());
+    _spare_transfers.pop_back();
+    return transfer;
+  }
+
+  void _release_transfer(std::unique_ptr<Transfer> transfer) {
+    transfer->reset();
+    _spare_transfers.push_back(std::move(transfer));
+  }
+
+  static std::expected<void, AgatetepeError>
+  _apply_http_version(CURL *curl, const HttpVersion version) {
+    long curl_version = CURL_HTTP_VERSION_NONE;
+
+    switch (version) {
+    case HttpVersion::unspecified:
+      break;
+    case HttpVersion::http1_0:
+      curl_version = CURL_HTTP_VERSION_1_0;
+      break;
+    case HttpVersion::http1_1:
+      curl_version = CURL_HTTP_VERSION_1_1;
+      break;
+    case HttpVersion::http2:
+      // Negotiated through ALPN over TLS, Upgrade on cleartext
+      curl_version = CURL_HTTP_VERSION_2_0;
+      break;
+    case HttpVersion::http2_prior_knowledge:
+      curl_version = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+      break;
+    case HttpVersion::http3:
+      if (!(curl_version_info(CURLVERSION_NOW)->features &
+            CURL_VERSION_HTTP3)) {
+        return std::unexpected(AgatetepeError{
+            .code = e_agatetepe_error::curl_error,
+            .message = "HTTP/3 is not supported by this libcurl build"});
+      }
+      curl_version = CURL_HTTP_VERSION_3;
+      break;
+    }
+
+    if (curl_version != CURL_HTTP_VERSION_NONE) {
+      curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, curl_version);
+    }
+
+    // Concurrent transfers to an origin wait for its first connection to
+    // tell whether it multiplexes, instead of each opening their own
+    if (version != HttpVersion::http1_0 && version != HttpVersion::http1_1) {
+      curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    }
+
+    return {};
+  }
+
+  static GzipEncoder &_encoder_of(Transfer &transfer) {
+    if (!transfer.encoder) {
+      transfer.encoder = std::make_unique<GzipEncoder>();
+    }
+    return *transfer.encoder;
+  }
+
+  // The rendered body, gzipped when the request asks for it. It stays in
+  // the transfer's buffers, curl doesn't copy it.
+  std::expected<std::string_view, AgatetepeError>
+  _render_body(Transfer &transfer, const HttpRequest &request) {
+    request.body.render_into(transfer.body, _responses);
+
+    if (!request.gzip_body) {
+      return transfer.body;
+    }
+
+    if (auto encoded = _encoder_of(transfer).encode_all(
+            transfer.body, transfer.encoded_body);
+        !encoded) {
+      return std::unexpected(encoded.error());
+    }
+    return transfer.encoded_body;
+  }
+
+  std::expected<void, AgatetepeError>
+  _prepare_transfer(Transfer &transfer, const HttpRequest &request) {
+    request.url.render_into(transfer.url, _responses);
+    transfer.origin = _origin_of(transfer.url);
+    transfer.curl = _acquire_handle(transfer.origin);
+    if (!transfer.curl) {
+      return std::unexpected(
+          AgatetepeError{.code = e_agatetepe_error::curl_error,
+                         .message = "Failed to initialise cURL easy handler."});
+    }
+
+    CURL *curl = transfer.curl;
+
+    curl_easy_setopt(curl, CURLOPT_SHARE, _share);
+    curl_easy_setopt(curl, CURLOPT_RESOLVE, _resolve);
+
+    if (_responses && !request.name.empty() &&
+        _responses->tracks(request.name)) {
+      transfer.capture_as = request.name;
+    }
+
+    // Set the URL
+    curl_easy_setopt(curl, CURLOPT_URL, transfer.url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _curl_write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer);
+
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, _curl_header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &transfer.response.headers);
+
+    if (auto applied = _apply_http_version(curl, request.http_version);
+        !applied) {
+      _discard_transfer(transfer);
+      return applied;
+    }
+
+    // Once requests were started, the transfer thread's multi handle holds
+    // connections of its own: a transfer waiting to multiplex on one of them
+    // would never be woken. And requests sent by hand mustn't queue up behind
+    // a hung one anyway, those sent after it answered still multiplex.
+    if (_transfer_thread) {
+      curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 0L);
+    }
+
+    // Every content encoding this libcurl build can decode is offered, and
+    // decoded on the fly before the body reaches the sink
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+
+    // --- Set HTTP Method and Body ---
+    if (request.body_file) {
+      transfer.upload = create_mmap_reader(request.body_file->string());
+      if (!transfer.upload->is_open()) {
+        _discard_transfer(transfer);
+        return std::unexpected(AgatetepeError{
+            .code = e_agatetepe_error::io_error,
+            .message = std::format("Failed to open request body {}",
+                                   request.body_file->string())});
+      }
+
+      // The mapping is fed to curl as it drains the socket; the seek callback
+      // lets it rewind when a stale keep-alive connection forces a resend
+      curl_easy_setopt(curl, CURLOPT_POST, 1L);
+      curl_easy_setopt(curl, CURLOPT_READFUNCTION, _curl_read_callback);
+      curl_easy_setopt(curl, CURLOPT_READDATA, &transfer);
+      curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, _curl_seek_callback);
+      curl_easy_setopt(curl, CURLOPT_SEEKDATA, &transfer);
+
+      if (request.gzip_body) {
+        // The encoded size is unknown upfront, so HTTP/1.1 goes chunked
+        _encoder_of(transfer).reset();
+        transfer.encode_upload = true;
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, curl_off_t(-1));
+      } else {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                         static_cast<curl_off_t>(transfer.upload->get_size()));
+      }
+
+      if (request.method != "POST") {
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, request.method.c_str());
+      }
+    } else if (request.method == "POST") {
+      // curl doesn't copy POSTFIELDS, the buffer lives with the transfer
+      const auto payload = _render_body(transfer, request);
+      if (!payload) {
+        _discard_transfer(transfer);
+        return std::unexpected(payload.error());
+      }
+      curl_easy_setopt(curl, CURLOPT_POST, 1L);
+      curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                       static_cast<curl_off_t>(payload->size()));
+      curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload->data());
+    } else if (request.method == "PUT" || request.method == "PATCH" ||
+               request.method == "DELETE") {
+      curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, request.method.c_str());
+      if (!request.body.empty()) {
+        const auto payload = _render_body(transfer, request);
+        if (!payload) {
+          _discard_transfer(transfer);
+          return std::unexpected(payload.error());
+        }
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                         static_cast<curl_off_t>(payload->size()));
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload->data());
+      }
+    } else if (request.method != "GET") {
+      curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, request.method.c_str());
+    }
+
+    // --- Set Headers ---
+    const bool gzipped =
+        transfer.encode_upload || !transfer.encoded_body.empty();
+    bool own_encoding = false;
+    for (const auto &[key, value] : request.headers) {
+      // curl_slist_append copies the line
+      transfer.header_line.assign(key);
+      transfer.header_line += ": ";
+      const size_t value_start = transfer.header_line.size();
+      value.render_into(transfer.header_line, _responses);
+      transfer.headers_list =
+          curl_slist_append(transfer.headers_list, transfer.header_line.c_str());
+
+      // `# @gzip` only adds the header when the request doesn't say, and
+      // can't be told the body is encoded any other way
+      if (gzipped && equals_ignoring_case(key, "Content-Encoding")) {
+        own_encoding = true;
+        if (!equals_ignoring_case(
+                std::string_view(transfer.header_line).substr(value_start),
+                "gzip")) {
+          _discard_transfer(transfer);
+          return std::unexpected(AgatetepeError{
+              .code = e_agatetepe_error::parse_error,
+              .message = std::format("# @gzip conflicts with the request's {}",
+                                     transfer.header_line)});
+        }
+      }
+    }
+
+    if (gzipped && !own_encoding) {
+      transfer.headers_list =
+          curl_slist_append(transfer.headers_list, "Content-Encoding: gzip");
+    }
+
+    if (_cache && request.method == "GET") {
+      _prepare_cache(transfer);
+    }
+
+    if (transfer.headers_list) {
+      curl_easy_setopt(curl, CURLOPT_HTTPHEADER, transfer.headers_list);
+    }
+
+    return {};
+  }
+
+  // Makes the request conditional when a variant of it is cached. Requests
+  // that are conditional on their own are left alone, the 304 is theirs.
+  void _prepare_cache(Transfer &transfer) {
+    if (!_sent_header(transfer, "If-None-Match").empty() ||
+        !_sent_header(transfer, "If-Modified-Since").empty()) {
+      return;
+    }
+
+    transfer.cache = _cache;
+    transfer.cached = _cache->lookup(
+        "GET", transfer.url,
+        [&](std::string_view name) { return _sent_header(transfer, name); });
+    if (!transfer.cached) {
+      return;
+    }
+
+    const ResponseHeaders &headers = transfer.cached->headers;
+    for (const auto &[validator, condition] :
+         {std::pair{"ETag", "If-None-Match"},
+          std::pair{"Last-Modified", "If-Modified-Since"}}) {
+      if (auto value = headers.find(validator)) {
+        transfer.header_line = std::format("{}: {}", condition, *value);
+        transfer.headers_list = curl_slist_append(
+            transfer.headers_list, transfer.header_line.c_str());
+      }
+    }
+  }
+
+  // Value of a header the request sends, empty when it doesn't
+  static std::string_view _sent_header(const Transfer &transfer,
+                                       const std::string_view name) {
+    for (const curl_slist *item = transfer.headers_list; item;
+         item = item->next) {
+      const std::string_view line(item->data);
+      const size_t colon = line.find(':');
+      if (colon != std::string_view::npos &&
+          equals_ignoring_case(line.substr(0, colon), name)) {
+        const std::string_view value = line.substr(colon + 1);
+        return value.substr(std::min(value.find_first_not_of(' '),
+                                     value.size()));
+      }
+    }
+    return {};
+  }
+
+  // A 304 to a revalidation becomes the cached response, a storable 200
+  // starts a new cache object. Runs on the transfer thread of started
+  // requests: the cache entry is only written by _finish_transfer.
+  static void _cache_head(Transfer &transfer) {
+    HttpResponse &response = transfer.response;
+
+    if (response.status_code == 304 && transfer.cached) {
+      transfer.cache_object = transfer.cache->open_object(*transfer.cached);
+      if (!transfer.cache_object->is_open()) {
+        // Evicted by hand since the lookup, the 304 stands
+        transfer.cache_object.reset();
+        return;
+      }
+
+      response.status_code = transfer.cached->status_code;
+      ResponseCache::refresh_headers(*transfer.cached, response.headers);
+      response.headers = transfer.cached->headers;
+      response.cache = CacheOutcome::revalidated;
+      return;
+    }
+
+    if (response.status_code == 200 &&
+        ResponseCache::is_storable(response.headers)) {
+      transfer.cache_writer = transfer.cache->create_object();
+    }
+  }
+
+  // Records a fully received body in the cache, with the Vary values the
+  // request sent
+  static bool _store_in_cache(Transfer &transfer,
+                              const HttpResponse &response) {
+    ResponseCache::Variant variant;
+    variant.status_code = response.status_code;
+    variant.headers = response.headers;
+
+    for (const auto &field : response.headers.find_all("Vary")) {
+      for (const auto range : std::views::split(field.value, ',')) {
+        std::string_view name(range.begin(), range.end());
+        name = name.substr(std::min(name.find_first_not_of(' '), name.size()));
+        name = name.substr(0, name.find_last_not_of(' ') + 1);
+        if (!name.empty()) {
+          variant.vary.emplace_back(name, _sent_header(transfer, name));
+        }
+      }
+    }
+
+    return transfer.cache->store("GET", transfer.url, std::move(variant),
+                                 std::move(transfer.cache_writer));
+  }
+
+  std::expected<HttpResponse, AgatetepeError>
+  _finish_transfer(Transfer &transfer, CURLcode res) {
+    // Check for transport errors (e.g., network failure, couldn't resolve host)
+    if (res != CURLE_OK) {
+      _discard_transfer(transfer);
+      if (transfer.upload_error) {
+        return std::unexpected(*transfer.upload_error);
+      }
+      return std::unexpected(AgatetepeError{
+          .code = e_agatetepe_error::curl_error,
+          .message = std::format("curl_easy_perform() failed: {}",
+                                 curl_easy_strerror(res))});
+    }
+
+    CURL *curl = transfer.curl;
+
+    // Bodyless responses never reach the write callback
+    _send_head(transfer);
+
+    if (transfer.cache_object) {
+      _deliver(transfer, std::string_view(transfer.cache_object->get_data(),
+                                          transfer.cache_object->get_size()));
+    }
+
+    // Return the successful response object.
+    // The caller is now responsible for checking the status code.
+    HttpResponse response = std::move(transfer.response);
+    response.timings = _collect_timings(curl);
+
+    if (!transfer.sink && !response.body) {
+      response.body.emplace();
+    }
+
+    if (!transfer.capture_as.empty()) {
+      _responses->store(transfer.capture_as, response,
+                        transfer.sink ? transfer.captured : *response.body);
+    }
+
+    if (transfer.cache_writer && _store_in_cache(transfer, response)) {
+      response.cache = CacheOutcome::stored;
+    } else if (response.cache == CacheOutcome::revalidated) {
+      transfer.cache->refresh("GET", transfer.url, *transfer.cached);
+    }
+
+    long http_version = CURL_HTTP_VERSION_NONE;
+    curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &http_version);
+    response.http_version = http_version == CURL_HTTP_VERSION_1_0
+                                ? HttpVersion::http1_0
+                            : http_version == CURL_HTTP_VERSION_1_1
+                                ? HttpVersion::http1_1
+                            : http_version == CURL_HTTP_VERSION_2_0
+                                ? HttpVersion::http2
+                            : http_version == CURL_HTTP_VERSION_3
+                                ? HttpVersion::http3
+                                : HttpVersion::unspecified;
+
+    // Zero new connections means the transfer reused a pooled one
+    long new_connections = 0;
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &new_connections);
+    response.connection_reused = new_connections == 0;
+
+    // The header list is referenced by the handle until the next reset
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, nullptr);
+    curl_slist_free_all(transfer.headers_list);
+    transfer.headers_list = nullptr;
+    _release_handle(transfer.origin, curl);
+    transfer.curl = nullptr;
+
+    return response;
+  }
+
+  static HttpTimings _collect_timings(CURL *curl) {
+    auto get_time = [curl](CURLINFO info) {
+      curl_off_t value = 0;
+      curl_easy_getinfo(curl, info, &value);
+      return std::chrono::microseconds(value);
+    };
+
+    auto get_size = [curl](CURLINFO info) {
+      curl_off_t value = 0;
+      curl_easy_getinfo(curl, info, &value);
+      return static_cast<uint64_t>(std::max<curl_off_t>(value, 0));
+    };
+
+    return HttpTimings{
+        .name_lookup = get_time(CURLINFO_NAMELOOKUP_TIME_T),
+        .connect = get_time(CURLINFO_CONNECT_TIME_T),
+        .tls_handshake = get_time(CURLINFO_APPCONNECT_TIME_T),
+        .pre_transfer = get_time(CURLINFO_PRETRANSFER_TIME_T),
+        .time_to_first_byte = get_time(CURLINFO_STARTTRANSFER_TIME_T),
+        .total = get_time(CURLINFO_TOTAL_TIME_T),
+        .uploaded_bytes = get_size(CURLINFO_SIZE_UPLOAD_T),
+        .downloaded_bytes = get_size(CURLINFO_SIZE_DOWNLOAD_T),
+        .upload_speed = get_size(CURLINFO_SPEED_UPLOAD_T),
+        .download_speed = get_size(CURLINFO_SPEED_DOWNLOAD_T),
+    };
+  }
+
+  // A failed handle may hold a half-closed connection, don't pool it
+  static void _discard_transfer(Transfer &transfer) {
+    curl_easy_cleanup(transfer.curl);
+    curl_slist_free_all(transfer.headers_list);
+    transfer.curl = nullptr;
+    transfer.headers_list = nullptr;
+  }
+
+  // Status code and headers are complete once the body starts flowing
+  static void _send_head(Transfer &transfer) {
+    if (transfer.head_sent) {
+      return;
+    }
+
+    transfer.head_sent = true;
+    curl_easy_getinfo(transfer.curl, CURLINFO_RESPONSE_CODE,
+                      &transfer.response.status_code);
+
+    if (transfer.cache) {
+      _cache_head(transfer);
+    }
+
+    if (transfer.sink) {
+      transfer.sink->on_head(transfer.response);
+    }
+  }
+
+  static size_t _curl_write_callback(char *contents, size_t size, size_t nmemb,
+                                     void *userdata) {
+    auto *transfer = static_cast<Transfer *>(userdata);
+    size_t total_size = size * nmemb;
+
+    _send_head(*transfer);
+
+    const std::string_view chunk(contents, total_size);
+    if (transfer->cache_writer && !transfer->cache_writer->write(chunk)) {
+      // Not worth failing the request over, it just won't be cached
+      transfer->cache_writer.reset();
+    }
+
+    // Anything short of total_size makes curl fail with CURLE_WRITE_ERROR
+    return _deliver(*transfer, chunk) ? total_size : 0;
+  }
+
+  // Hands body bytes to the sink, or to the buffered body without one
+  static bool _deliver(Transfer &transfer, const std::string_view chunk) {
+    if (!transfer.sink) {
+      if (!transfer.response.body) {
+        transfer.response.body.emplace();
+      }
+      transfer.response.body->append(chunk);
+      return true;
+    }
+
+    if (!transfer.capture_as.empty()) {
+      transfer.captured.append(chunk);
+    }
+
+    return transfer.sink->write(chunk);
+  }
+
+  static size_t _curl_read_callback(char *buffer, size_t size, size_t nitems,
+                                    void *userdata) {
+    auto *transfer = static_cast<Transfer *>(userdata);
+    const MmapReader &upload = *transfer->upload;
+    size_t chunk_size = 0;
+
+    if (transfer->encode_upload) {
+      // Returning 0 ends the upload, so only once the trailer is out
+      auto &encoder = *transfer->encoder;
+      while (chunk_size == 0 && !encoder.finished()) {
+        const auto encoded = encoder.encode(
+            std::string_view(upload.get_data() + transfer->upload_offset,
+                             upload.get_size() - transfer->upload_offset),
+            std::span(buffer, size * nitems));
+        if (!encoded) {
+          transfer->upload_error = encoded.error();
+          return CURL_READFUNC_ABORT;
+        }
+        transfer->upload_offset += encoded->first;
+        chunk_size = encoded->second;
+      }
+    } else {
+      chunk_size =
+          std::min(size * nitems, upload.get_size() - transfer->upload_offset);
+      // An empty file has no mapping to copy from
+      if (chunk_size == 0) {
+        return 0;
+      }
+      std::memcpy(buffer, upload.get_data() + transfer->upload_offset,
+                  chunk_size);
+      transfer->upload_offset += chunk_size;
+    }
+
+    // Keeps huge uploads from piling up in resident memory
+    if (transfer->upload_offset - transfer->upload_released >=
+        _upload_release_step) {
+      transfer->upload->release(transfer->upload_released,
+                                transfer->upload_offset -
+                                    transfer->upload_released);
+      transfer->upload_released = transfer->upload_offset;
+    }
+
+    return chunk_size;
+  }
+
+  static int _curl_seek_callback(void *userdata, curl_off_t offset,
+                                 int origin) {
+    auto *transfer = static_cast<Transfer *>(userdata);
+
+    if (origin != SEEK_SET || offset < 0 ||
+        static_cast<size_t>(offset) > transfer->upload->get_size()) {
+      return CURL_SEEKFUNC_CANTSEEK;
+    }
+
+    // Encoded uploads can only start over
+    if (transfer->encode_upload) {
+      if (offset != 0) {
+        return CURL_SEEKFUNC_CANTSEEK;
+      }
+      transfer->encoder->reset();
+    }
+
+    transfer->upload_offset = static_cast<size_t>(offset);
+    transfer->upload_released =
+        std::min(transfer->upload_released, transfer->upload_offset);
+    return CURL_SEEKFUNC_OK;
+  }
+
+  struct WarmUpTarget {
+    HttpVersion version = HttpVersion::unspecified;
+    size_t requests = 0;
+    // How many connections the next round opens
+    size_t connections = 0;
+    bool multiplexed = false;
+  };
+
+  // One round of warm-up: opens `connections` connections to each target at
+  // once, all left idle in the share's cache. Returns how many were opened.
+  size_t _open_connections(std::map<std::string, WarmUpTarget> &targets) {
+    CURLM *multi = curl_multi_init();
+    if (!multi) {
+      return 0;
+    }
+
+    std::vector<std::pair<const std::string *, CURL *>> handles;
+    for (const auto &[origin, target] : targets) {
+      for (size_t i = 0; i < target.connections; i++) {
+        CURL *curl = _acquire_handle(origin);
+        if (!curl) {
+          break;
+        }
+
+        curl_easy_setopt(curl, CURLOPT_SHARE, _share);
+        curl_easy_setopt(curl, CURLOPT_RESOLVE, _resolve);
+        curl_easy_setopt(curl, CURLOPT_URL, origin.c_str());
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "OPTIONS");
+        curl_easy_setopt(curl, CURLOPT_REQUEST_TARGET, "*");
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _curl_discard_callback);
+
+        if (!_apply_http_version(curl, target.version)) {
+          _release_handle(origin, curl);
+          break;
+        }
+        // Every transfer of a round gets its own connection
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 0L);
+        curl_easy_setopt(curl, CURLOPT_FRESH_CONNECT, 1L);
+
+        curl_multi_add_handle(multi, curl);
+        handles.emplace_back(&origin, curl);
+      }
+    }
+
+    int still_running = 0;
+    do {
+      if (curl_multi_perform(multi, &still_running) != CURLM_OK) {
+        break;
+      }
+      if (still_running > 0 &&
+          curl_multi_poll(multi, nullptr, 0, 1000, nullptr) != CURLM_OK) {
+        break;
+      }
+    } while (still_running > 0);
+
+    size_t opened = 0;
+    int queued = 0;
+    while (CURLMsg *message = curl_multi_info_read(multi, &queued)) {
+      if (message->msg != CURLMSG_DONE || message->data.result != CURLE_OK) {
+        continue;
+      }
+
+      long new_connections = 0;
+      long version = 0;
+      curl_easy_getinfo(message->easy_handle, CURLINFO_NUM_CONNECTS,
+                        &new_connections);
+      curl_easy_getinfo(message->easy_handle, CURLINFO_HTTP_VERSION,
+                        &version);
+      opened += static_cast<size_t>(new_connections);
+
+      const auto handle = std::ranges::find(
+          handles, message->easy_handle, &decltype(handles)::value_type::second);
+      targets[*handle->first].multiplexed =
+          version == CURL_HTTP_VERSION_2_0 || version == CURL_HTTP_VERSION_3;
+    }
+
+    for (const auto &[origin, curl] : handles) {
+      curl_multi_remove_handle(multi, curl);
+      _release_handle(*origin, curl);
+    }
+
+    curl_multi_cleanup(multi);
+    return opened;
+  }
+
+  static size_t _curl_discard_callback(char *, size_t size, size_t nmemb,
+                                       void *) {
+    return size * nmemb;
+  }
+
+  // Called on the transfer thread, often while bytes flow and about once a
+  // second otherwise
+  static int _curl_progress_callback(void *userdata, curl_off_t download_size,
+                                     curl_off_t downloaded,
+                                     curl_off_t upload_size,
+                                     curl_off_t uploaded) {
+    auto *transfer = static_cast<Transfer *>(userdata);
+    auto bytes = [](const curl_off_t value) {
+      return static_cast<uint64_t>(std::max<curl_off_t>(value, 0));
+    };
+
+    transfer->started->set_progress({.downloaded = bytes(downloaded),
+                                     .download_size = bytes(download_size),
+                                     .uploaded = bytes(uploaded),
+                                     .upload_size = bytes(upload_size)});
+
+    // Anything but 0 aborts the transfer
+    return transfer->started->cancelled() ? 1 : 0;
+  }
+
+  using ShareLocks = std::array<std::mutex, CURL_LOCK_DATA_LAST>;
+
+  static void _lock_share(CURL *, curl_lock_data data, curl_lock_access,
+                          void *locks) {
+    (*static_cast<ShareLocks *>(locks))[data].lock();
+  }
+
+  static void _unlock_share(CURL *, curl_lock_data data, void *locks) {
+    (*static_cast<ShareLocks *>(locks))[data].unlock();
+  }
+
+  static size_t _curl_header_callback(char *buffer, size_t size, size_t nitems,
+                                      void *userdata) {
+    size_t total_size = size * nitems;
+
+    static_cast<ResponseHeaders *>(userdata)->append_line(
+        std::string_view(buffer, total_size));
+
+    return total_size;
+  }
+
+  // Pool key: requests that share scheme, host and port can share a
+  // connection, everything else in the URL is irrelevant for reuse.
+  static std::string _origin_of(const std::string &url) {
+    std::string origin = url;
+    CURLU *parsed = curl_url();
+
+    if (parsed && curl_url_set(parsed, CURLUPART_URL, url.c_str(),
+                               CURLU_DEFAULT_SCHEME) == CURLUE_OK) {
+      char *scheme = nullptr;
+      char *host = nullptr;
+      char *port = nullptr;
+
+      if (curl_url_get(parsed, CURLUPART_SCHEME, &scheme, 0) == CURLUE_OK &&
+          curl_url_get(parsed, CURLUPART_HOST, &host, 0) == CURLUE_OK &&
+          curl_url_get(parsed, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT) ==
+              CURLUE_OK) {
+        origin = std::format("{}://{}:{}", scheme, host, port);
+      }
+
+      curl_free(scheme);
+      curl_free(host);
+      curl_free(port);
+    }
+
+    curl_url_cleanup(parsed);
+    return origin;
+  }
+
+  CURL *_acquire_handle(const std::string &origin) {
+    if (auto it = _idle_handles.find(origin);
+        it != _idle_handles.end() && !it->second.empty()) {
+      CURL *handle = it->second.back();
+      it->second.pop_back();
+      // Drops the options of the previous request, keeps its live
+      // connections and caches
+      curl_easy_reset(handle);
+      return handle;
+    }
+
+    return curl_easy_init();
+  }
+
+  void _release_handle(const std::string &origin, CURL *handle) {
+    auto &handles = _idle_handles[origin];
+
+    if (handles.size() >= _max_idle_handles_per_origin) {
+      curl_easy_cleanup(handle);
+      return;
+    }
+
+    handles.push_back(handle);
+  }
+
+  static constexpr size_t _max_idle_handles_per_origin = 8;
+  static constexpr size_t _upload_release_step = 8 * 1024 * 1024;
+
+  CURLSH *_share = nullptr;
+  ShareLocks _share_locks;
+  struct curl_slist *_resolve = nullptr;
+  std::map<std::string, std::vector<CURL *>> _idle_handles;
+  std::vector<std::unique_ptr<Transfer>> _spare_transfers;
+  std::unique_ptr<TransferThread> _transfer_thread;
+};
+
+// Double-buffered terminal drawing. A frame is a screenful of rows; only
+// the rows that differ from the frame before are sent, all in one write, so
+// redrawing after a key press costs a line or two instead of the screen.
+class TerminalRenderer {
+public:
+  explicit TerminalRenderer(std::unique_ptr<TerminalScreen> screen)
+      : _screen(std::move(screen)) {}
+
+  ~TerminalRenderer() { _screen->write(_show_cursor); }
+
+  TerminalRenderer(const TerminalRenderer &) = delete;
+  TerminalRenderer &operator=(const TerminalRenderer &) = delete;
+
+  // Starts a blank frame the size of the terminal
+  void begin_frame() {
+    const auto size = _screen->size();
+    if (_screen->resized() || size != _size) {
+      _size = size;
+      _redraw = true;
+    }
+
+    _next.resize(_size.rows);
+    for (auto &line : _next) {
+      line.clear();
+    }
+  }
+
+  size_t rows() const { return _size.rows; }
+  size_t columns() const { return _size.columns; }
+
+  // Whether the terminal was resized since the last frame, for the callers
+  // that draw one only when something changed. The next frame is drawn from
+  // scratch.
+  bool resized() {
+    if (_screen->resized() || _screen->size() != _size) {
+      _redraw = true;
+    }
+    return _redraw;
+  }
+
+  // Row `row` of the frame, to fill in. Rows past the bottom of the screen
+  // are dropped, text past its right edge is cut.
+  std::string &line(const size_t row) {
+    if (row >= _next.size()) {
+      _offscreen.clear();
+      return _offscreen;
+    }
+    return _next[row];
+  }
+
+  void end_frame() {
+    std::string out;
+    if (_redraw) {
+      out += _hide_cursor;
+      out += "\033[H\033[2J";
+      _shown.assign(_next.size(), std::string());
+    }
+
+    for (size_t row = 0; row < _next.size(); row++) {
+      _clip(_next[row]);
+      if (_next[row] != _shown[row]) {
+        out += std::format("\033[{};1H", row + 1);
+        out += _next[row];
+        out += "\033[K";
+      }
+    }
+
+    _shown.swap(_next);
+    _redraw = false;
+
+    if (!out.empty()) {
+      // Anything printed before must land first
+      std::fflush(stdout);
+      _screen->write(out);
+    }
+  }
+
+  // Hands the terminal back for plain output, like a response being
+  // printed. The next frame is drawn from scratch.
+  void release() {
+    std::fflush(stdout);
+    _screen->write(std::string(_show_cursor) + "\033[H\033[2J");
+    _redraw = true;
+  }
+
+private:
+  static constexpr std::string_view _hide_cursor = "\033[?25l";
+  static constexpr std::string_view _show_cursor = "\033[?25h";
+
+  std::unique_ptr<TerminalScreen> _screen;
+  TerminalScreen::Size _size;
+  // What the terminal shows, and the frame being drawn
+  std::vector<std::string> _shown;
+  std::vector<std::string> _next;
+  std::string _offscreen;
+  bool _redraw = true;
+
+  // A row that wrapped would push every row below it down. Columns are
+  // counted in code points, control characters would move the cursor.
+  void _clip(std::string &line) const {
+    size_t columns = 0;
+    for (size_t i = 0; i < line.size(); i++) {
+      auto &byte = reinterpret_cast<unsigned char &>(line[i]);
+      if (byte < 0x20 || byte == 0x7f) {
+        byte = ' ';
+      }
+      if ((byte & 0xc0) != 0x80 && columns++ == _size.columns) {
+        line.resize(i);
+        return;
+      }
+    }
+  }
+};
+
+// Trigram index over the names, methods and URLs of the requests, for the
+// menu's filter. Built once per collection; a query then costs the requests
+// sharing its rarest trigram, not the whole collection.
+class RequestIndex {
+public:
+  RequestIndex() = default;
+
+  explicit RequestIndex(std::span<const HttpRequest> requests) {
+    // The text searched, lowercased, one after the other
+    _starts.reserve(requests.size() + 1);
+    for (const auto &request : requests) {
+      _starts.push_back(static_cast<uint32_t>(_text.size()));
+      _text += request.name;
+      _text += ' ';
+      _text += request.method;
+      _text += ' ';
+      _text += request.url.display();
+    }
+    _starts.push_back(static_cast<uint32_t>(_text.size()));
+    std::ranges::transform(_text, _text.begin(), _lower);
+
+    // Counting sort of (trigram, request) pairs: a pass to size each
+    // trigram's postings, another to fill them in request order
+    std::vector<uint32_t> last(_buckets, _none);
+    _offsets.assign(_buckets + 1, 0);
+    _each_trigram(
+        [&](const size_t bucket, uint32_t) { _offsets[bucket + 1]++; }, last);
+
+    std::partial_sum(_offsets.begin(), _offsets.end(), _offsets.begin());
+    _postings.resize(_offsets.back());
+
+    std::vector<uint32_t> next(_offsets.begin(), _offsets.end() - 1);
+    last.assign(_buckets, _none);
+    _each_trigram(
+        [&](const size_t bucket, const uint32_t request) {
+          _postings[next[bucket]++] = request;
+        },
+        last);
+  }
+
+  size_t size() const { return _starts.empty() ? 0 : _starts.size() - 1; }
+
+  // Requests matching `query`, in collection order. Each word of the query
+  // must show up in the name, method or URL, in any order and case.
+  // `within` narrows the search to the matches of an earlier query, like
+  // the same query before the last key press.
+  std::vector<uint32_t>
+  find(const std::string_view query,
+       std::span<const uint32_t> within = {}) const {
+    std::vector<std::string> words;
+    for (const auto word : std::views::split(query, ' ')) {
+      if (!word.empty()) {
+        words.emplace_back(word.begin(), word.end());
+        std::ranges::transform(words.back(), words.back().begin(), _lower);
+      }
+    }
+
+    // Candidates are the requests with the rarest trigram of any word. A
+    // query of short words only has to look at every request.
+    std::optional<std::span<const uint32_t>> candidates;
+    if (!within.empty()) {
+      candidates = within;
+    }
+    for (const auto &word : words) {
+      for (size_t i = 0; i + 3 <= word.size(); i++) {
+        const auto postings = _postings_of(_bucket(&word[i]));
+        if (!candidates || postings.size() < candidates->size()) {
+          candidates = postings;
+        }
+      }
+    }
+
+    std::vector<uint32_t> matches;
+    auto check = [&](const uint32_t request) {
+      const std::string_view text(_text.data() + _starts[request],
+                                  _starts[request + 1] - _starts[request]);
+      if (std::ranges::all_of(words, [&](const std::string &word) {
+            return text.find(word) != std::string_view::npos;
+          })) {
+        matches.push_back(request);
+      }
+    };
+
+    if (candidates) {
+      std::ranges::for_each(*candidates, check);
+    } else {
+      for (uint32_t request = 0; request < size(); request++) {
+        check(request);
+      }
+    }
+    return matches;
+  }
+
+private:
+  static constexpr uint32_t _none = std::numeric_limits<uint32_t>::max();
+  // Characters fold to 6 bits, exactly for letters, digits and the
+  // punctuation of URLs, so a trigram is 18 bits
+  static constexpr size_t _buckets = size_t{1} << 18;
+  static constexpr std::array<uint8_t, 256> _classes = [] {
+    std::array<uint8_t, 256> classes{};
+    constexpr std::string_view exact = "abcdefghijklmnopqrstuvwxyz0123456789"
+                                       " /.:?=&-_{}%#@+,;~!$*'()[]";
+    for (size_t c = 0; c < classes.size(); c++) {
+      classes[c] = static_cast<uint8_t>(exact.size() + c % (64 - exact.size()));
+    }
+    for (size_t i = 0; i < exact.size(); i++) {
+      classes[static_cast<unsigned char>(exact[i])] = static_cast<uint8_t>(i);
+    }
+    return classes;
+  }();
+
+  std::string _text;
+  // Where each request's text starts, and the end of the last
+  std::vector<uint32_t> _starts;
+  // The requests holding a trigram, in order, are
+  // _postings[_offsets[bucket]] up to _postings[_offsets[bucket + 1]]
+  std::vector<uint32_t> _offsets;
+  std::vector<uint32_t> _postings;
+
+  static char _lower(const char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+  }
+
+  static size_t _bucket(const char *trigram) {
+    const auto fold = [](const char c) -> size_t {
+      return _classes[static_cast<unsigned char>(c)];
+    };
+    return fold(trigram[0]) << 12 | fold(trigram[1]) << 6 | fold(trigram[2]);
+  }
+
+  std::span<const uint32_t> _postings_of(const size_t bucket) const {
+    return std::span(_postings).subspan(
+        _offsets[bucket], _offsets[bucket + 1] - _offsets[bucket]);
+  }
+
+  // Calls `visit` once per distinct trigram of each request
+  template <typename F>
+  void _each_trigram(F &&visit, std::vector<uint32_t> &last) const {
+    for (uint32_t request = 0; request < size(); request++) {
+      for (uint32_t i = _starts[request]; i + 3 <= _starts[request + 1]; i++) {
+        const size_t bucket = _bucket(&_text[i]);
+        if (last[bucket] != request) {
+          last[bucket] = request;
+          visit(bucket, request);
+        }
+      }
+    }
+  }
+};
+
+// Terminal menu for selecting requests. Only the requests that fit on
+// screen are drawn, scrolled to keep the selected one in view. Typing after
+// `/` filters the list down to the requests matching the text.
+class RequestMenu {
+public:
+  // The requests are owned by the app's ParsedCollection
+  void set_requests(std::span<const HttpRequest> requests) {
+    _requests = requests;
+    if (_index) {
+      _index.emplace(_requests);
+    }
+    if (_filtered()) {
+      _matches = _index->find(_filter);
+    }
+    _selected = std::clamp(_selected, 0, std::max(_count() - 1, 0));
+    _top = std::min(_top, _selected);
+  }
+
+  // Indexes the requests for the filter, and again on every set_requests
+  // from then on
+  void build_index() { _index.emplace(_requests); }
+
+  void jump_to(int index) {
+    _clear_filter();
+    _selected = index;
+  }
+
+  // Shown under the menu, like the outcome of the last --watch reload
+  void set_status(std::string status) { _status = std::move(status); }
+
+  // Shown under the help, like the progress of the requests sent. Whether
+  // that changed what's shown.
+  bool set_activity(std::vector<std::string> lines) {
+    if (lines == _activity) {
+      return false;
+    }
+    _activity = std::move(lines);
+    return true;
+  }
+
+  // The help, activity and status lines stay at the bottom of what fits,
+  // the list or details above them are cut to the rows left
+  void display(TerminalRenderer &screen) {
+    screen.begin_frame();
+    size_t row = 0;
+
+    screen.line(row++) = "HTTP Request Selector";
+    screen.line(row++) = "=====================";
+    if (_filtering || _filtered()) {
+      screen.line(row) = std::format("/{}{}  ({} of {})", _filter,
+                                     _filtering ? "_" : "", _count(),
+                                     _requests.size());
+    }
+    row++;
+
+    // What's left once the help, activity and status lines are in, a row
+    // at least
+    const size_t footer = 2 + (_activity.empty() ? 0 : _activity.size() + 1) +
+                          (_status.empty() ? 0 : 2);
+    const size_t visible =
+        screen.rows() > row + footer ? screen.rows() - row - footer : 1;
+
+    if (_requests.empty()) {
+      screen.line(row++) = "No requests available.";
+    } else if (_count() == 0) {
+      screen.line(row++) = "No requests match.";
+    } else if (_show_details && _selected >= 0 && _selected < _count()) {
+      row = _display_details(screen, row, row + visible, screen.columns());
+    } else {
+      _scroll(visible);
+
+      const size_t first_row = row;
+      for (int i = _top;
+           i < _count() && row - first_row + _height(i) <= visible; i++) {
+        const auto &request = _request(i);
+        std::string &line = screen.line(row++);
+        line = i == _selected ? "> " : "  ";
+
+        if (!request.name.empty()) {
+          line += std::format("# {}", request.name);
+          screen.line(row++) = std::format("    {} {}", request.method,
+                                           request.url.display());
+        } else {
+          line += std::format("{} {}", request.method, request.url.display());
+        }
+      }
+    }
+
+    row++;
+    if (_filtering) {
+      screen.line(row++) = "Type to filter by name, method or URL, Enter to "
+                           "keep the filter, Esc to clear it.";
+    } else {
+      screen.line(row++) = "Press 'd' to toggle details, '/' to filter, arrow "
+                           "keys to navigate, Enter to send, q to quit.";
+    }
+    if (!_activity.empty()) {
+      row++;
+      for (const auto &line : _activity) {
+        screen.line(row++) = line;
+      }
+    }
+    if (!_status.empty()) {
+      row++;
+      screen.line(row++) = _status;
+    }
+
+    screen.end_frame();
+  }
+
+  void move_up() {
+    if (_selected > 0) {
+      _selected--;
+    }
+  }
+
+  void move_down() {
+    if (_selected < _count() - 1) {
+      _selected++;
+    }
+  }
+
+  void toggle_details() { _show_details = !_show_details; }
+
+  // While the filter prompt is open, typed keys go to the filter
+  bool filtering() const { return _filtering; }
+
+  void start_filter() { _filtering = true; }
+
+  // A longer filter only narrows the requests matched so far
+  void filter_append(const char c) {
+    const size_t selected = _selected_index();
+    const bool narrowing = _filtered();
+    _filter += c;
+    _refilter(selected, narrowing ? std::span<const uint32_t>(_matches)
+                                  : std::span<const uint32_t>());
+  }
+
+  void filter_erase() {
+    if (!_filter.empty()) {
+      const size_t selected = _selected_index();
+      _filter.pop_back();
+      _refilter(selected, {});
+    }
+  }
+
+  // Closes the prompt, the list stays filtered
+  void accept_filter() { _filtering = false; }
+
+  void clear_filter() {
+    const size_t selected = _selected_index();
+    _clear_filter();
+    _refilter(selected, {});
+  }
+
+  const HttpRequest *get_selected() const {
+    if (_selected >= 0 && _selected < _count()) {
+      return &_request(_selected);
+    }
+    return nullptr;
+  }
+
+  void reset() {
+    _clear_filter();
+    _selected = 0;
+    _top = 0;
+    _show_details = false;
+  }
+
+  // The whole collection, filtered or not
+  size_t size() const { return _requests.size(); }
+
+  std::span<const HttpRequest> requests() const { return _requests; }
+
+private:
+  std::span<const HttpRequest> _requests;
+  // Position of the selected request and of the first one on screen, in
+  // the list as shown
+  int _selected = 0;
+  int _top = 0;
+  bool _show_details = false;
+  std::string _status;
+  std::vector<std::string> _activity;
+  std::optional<RequestIndex> _index;
+  // The list shows the requests matching `_filter`, all of them while it's
+  // empty
+  std::string _filter;
+  std::vector<uint32_t> _matches;
+  bool _filtering = false;
+
+  bool _filtered() const { return !_filter.empty(); }
+
+  int _count() const {
+    return static_cast<int>(_filtered() ? _matches.size() : _requests.size());
+  }
+
+  size_t _index_of(const int position) const {
+    return _filtered() ? _matches[position] : static_cast<size_t>(position);
+  }
+
+  const HttpRequest &_request(const int position) const {
+    return _requests[_index_of(position)];
+  }
+
+  // In the collection
+  size_t _selected_index() const {
+    return _selected < _count() ? _index_of(_selected) : 0;
+  }
+
+  void _clear_filter() {
+    _filter.clear();
+    _matches.clear();
+    _filtering = false;
+  }
+
+  // Matches `_filter` again, keeping the selection on request `selected`
+  // of the collection, or the next one still listed
+  void _refilter(const size_t selected,
+                 const std::span<const uint32_t> within) {
+    if (!_index) {
+      build_index();
+    }
+
+    // `within` may be the old matches, they are replaced only once found
+    auto matches = _filtered() ? _index->find(_filter, within)
+                               : std::vector<uint32_t>();
+    _matches = std::move(matches);
+
+    _selected = _filtered() ? static_cast<int>(std::ranges::lower_bound(
+                                                   _matches, selected) -
+                                               _matches.begin())
+                            : static_cast<int>(selected);
+    _selected = std::clamp(_selected, 0, std::max(_count() - 1, 0));
+    _top = std::min(_top, _selected);
+  }
+
+  // Named requests take a line for the name
+  size_t _height(const int position) const {
+    return _request(position).name.empty() ? 1 : 2;
+  }
+
+  // Moves the first request on screen as little as possible for the
+  // selected one to show in `visible` lines. Looks at a screenful of
+  // requests at most, whatever the size of the collection.
+  void _scroll(const size_t visible) {
+    if (_selected < _top) {
+      _top = _selected;
+      return;
+    }
+
+    size_t used = 0;
+    int first = _selected;
+    while (first >= _top && used + _height(first) <= visible) {
+      used += _height(first);
+      first--;
+    }
+    _top = std::min(std::max(_top, first + 1), _selected);
+  }
+
+  // Fills rows `row` up to `end` at most, and returns the row after the
+  // last one filled
+  size_t _display_details(TerminalRenderer &screen, size_t row,
+                          const size_t end, const size_t columns) const {
+    const auto &request = _request(_selected);
+    // Multi-line values take a row per line
+    auto add = [&](const std::string_view text) {
+      for (const auto line : std::views::split(text, '\n')) {
+        if (row == end) {
+          return;
+        }
+        screen.line(row++) = std::string_view(line.begin(), line.end());
+      }
+    };
+
+    add(std::format("Name: {}", request.name));
+    add(std::format("Method: {}", request.method));
+    add(std::format("URL: {}", request.url.display()));
+    if (request.http_version != HttpVersion::unspecified) {
+      add(std::format("Version: {}", http_version_name(request.http_version)));
+    }
+
+    if (!request.headers.empty()) {
+      add("Headers:");
+      for (const auto &header : request.headers) {
+        add(std::format("   {}: {}", header.key, header.value.display()));
+      }
+    }
+
+    if (request.body_file) {
+      add(std::format("Body:\n< {}", request.body_file->string()));
+    } else if (!request.body.empty()) {
+      add("Body:");
+      _display_body(screen, request.body, row, end, columns);
+    }
+
+    return row;
+  }
+
+  // The body can be large: it's laid out segment by segment only as far as
+  // the rows go, and a row takes no more than its columns' worth of bytes
+  // (a code point is four at most)
+  static void _display_body(TerminalRenderer &screen,
+                            const RequestTemplate &body, size_t &row,
+                            const size_t end, const size_t columns) {
+    if (row == end) {
+      return;
+    }
+
+    for (const auto &segment : body.segments()) {
+      const bool literal =
+          segment.kind == RequestTemplate::SlotKind::literal;
+      const std::string slot =
+          literal ? std::string() : std::format("{{{{{}}}}}", segment.text);
+      const std::string_view text = literal ? segment.text : slot;
+
+      bool first = true;
+      for (const auto piece : std::views::split(text, '\n')) {
+        if (!first && row + 1 == end) {
+          row = end;
+          return;
+        }
+        if (!first) {
+          row++;
+        }
+        first = false;
+
+        std::string &line = screen.line(row);
+        const size_t room =
+            columns * 4 > line.size() ? columns * 4 - line.size() : 0;
+        line.append(
+            std::string_view(piece.begin(), piece.end()).substr(0, room));
+      }
+    }
+    row++;
+  }
+};
+
+// Full-screen viewer for a response: a few lines about it, then the body.
+// The body is usually a mapped file of any size, so nothing is done to all
+// of it up front. Lines are found as the view reaches them, and only the
+// rows on screen are ever formatted.
+class ResponsePager {
+public:
+  ResponsePager(std::string title, std::vector<std::string> head,
+                std::string_view body)
+      : _title(std::move(title)), _head(std::move(head)), _body(body),
+        _lines(body.empty() ? 0 : 1) {}
+
+  void display(TerminalRenderer &screen) {
+    _visible = screen.rows() > 2 ? screen.rows() - 2 : 1;
+    _clamp();
+
+    screen.begin_frame();
+    const size_t total = _head.size() + _lines;
+    screen.line(0) =
+        _lines == 0
+            ? std::format("{}  empty body", _title)
+            : std::format("{}  line {} of {}{}", _title,
+                          _top > _head.size() ? _top - _head.size() + 1 : 1,
+                          _lines, _indexed() ? "" : "+");
+
+    // The top line is looked up once, the ones below follow from it
+    const size_t gutter = 9;
+    const size_t width = screen.columns() > gutter
+                             ? (screen.columns() - gutter) * 4
+                             : 0;
+    size_t start = _top > _head.size() ? _line_start(_top - _head.size())
+                                       : 0;
+    for (size_t row = 0; row < _visible && _top + row < total; row++) {
+      const size_t line = _top + row;
+      if (line < _head.size()) {
+        screen.line(row + 1) = _head[line];
+        continue;
+      }
+
+      const size_t end = _line_end(start);
+      const bool matched = _match && *_match >= start && *_match <= end;
+      std::string &text = screen.line(row + 1);
+      text = std::format("{:>7}{} ", line - _head.size() + 1,
+                         matched ? '*' : ' ');
+      if (start + _left < end) {
+        text += _body.substr(start + _left,
+                             std::min(end - start - _left, width));
+      }
+      start = end + 1;
+    }
+
+    if (_prompt) {
+      screen.line(screen.rows() - 1) =
+          std::format("{}{}_", _prompt == '@' ? ":@" : std::string(1, *_prompt),
+                      _input);
+    } else if (!_status.empty()) {
+      screen.line(screen.rows() - 1) = _status;
+    } else {
+      screen.line(screen.rows() - 1) =
+          "Arrows scroll, Space/b page, g/G top/bottom, / search, n/N "
+          "next/previous, :N line, :@N byte offset, q back.";
+    }
+
+    screen.end_frame();
+  }
+
+  // False once the pager is closed
+  bool handle_key(const int key) {
+    if (_prompt) {
+      _prompt_key(key);
+      return true;
+    }
+
+    _status.clear();
+    if (key == 'q' || key == 'Q' || key == '\033') {
+      return false;
+    } else if (key == 1) { // Up arrow
+      _top = _top > 0 ? _top - 1 : 0;
+    } else if (key == 2) { // Down arrow
+      _top++;
+    } else if (key == 3) { // Right arrow
+      _left += _horizontal_step;
+    } else if (key == 4) { // Left arrow
+      _left = _left > _horizontal_step ? _left - _horizontal_step : 0;
+    } else if (key == ' ' || key == 'f') {
+      _top += _visible;
+    } else if (key == 'b') {
+      _top = _top > _visible ? _top - _visible : 0;
+    } else if (key == 'g') {
+      _top = 0;
+      _left = 0;
+    } else if (key == 'G') {
+      _index_until(_all, _all);
+      _top = _all;
+    } else if (key == '/' || key == ':') {
+      _prompt = static_cast<char>(key);
+      _input.clear();
+    } else if ((key == 'n' || key == 'N') && !_query.empty()) {
+      _search(key == 'n');
+    }
+
+    return true;
+  }
+
+private:
+  static constexpr size_t _all = std::numeric_limits<size_t>::max();
+  // A checkpoint every this many lines bounds a lookup to that many memchr
+  static constexpr size_t _stride = 64;
+  static constexpr size_t _horizontal_step = 20;
+
+  std::string _title;
+  std::vector<std::string> _head;
+  std::string_view _body;
+
+  // Where body lines 0, _stride, 2 * _stride... start, as far as the body
+  // was indexed: up to `_scanned`, with `_lines` lines found so far
+  std::vector<size_t> _checkpoints{0};
+  size_t _scanned = 0;
+  size_t _lines = 0;
+
+  // First line on screen, counting the head lines, and the first byte shown
+  // of every body line
+  size_t _top = 0;
+  size_t _left = 0;
+  size_t _visible = 1;
+
+  std::string _query;
+  std::optional<size_t> _match;
+  // The '/' or ':' prompt being typed in, '@' once ':' was followed by one
+  std::optional<char> _prompt;
+  std::string _input;
+  std::string _status;
+
+  bool _indexed() const { return _scanned == _body.size(); }
+
+  // Indexes the body up to line `line` or to the line holding byte
+  // `offset`, whichever comes first
+  void _index_until(const size_t line, const size_t offset) {
+    while (!_indexed() && _lines <= line && _scanned <= offset) {
+      const auto *found = static_cast<const char *>(
+          std::memchr(_body.data() + _scanned, '\n', _body.size() - _scanned));
+      if (!found) {
+        _scanned = _body.size();
+        break;
+      }
+
+      // A newline ending the body doesn't start another line
+      _scanned = static_cast<size_t>(found - _body.data()) + 1;
+      if (_scanned < _body.size()) {
+        if (_lines % _stride == 0) {
+          _checkpoints.push_back(_scanned);
+        }
+        _lines++;
+      }
+    }
+  }
+
+  // Offset of body line `line`, which must have been indexed
+  size_t _line_start(const size_t line) const {
+    size_t start = _checkpoints[line / _stride];
+    for (size_t i = 0; i < line % _stride; i++) {
+      start = _line_end(start) + 1;
+    }
+    return start;
+  }
+
+  // Offset of the newline ending the line at `start`, or of the end of the
+  // body
+  size_t _line_end(const size_t start) const {
+    const auto *found = static_cast<const char *>(
+        std::memchr(_body.data() + start, '\n', _body.size() - start));
+    return found ? static_cast<size_t>(found - _body.data()) : _body.size();
+  }
+
+  // Body line holding byte `offset`
+  size_t _line_of(const size_t offset) {
+    _index_until(_all, offset);
+    const size_t checkpoint =
+        std::ranges::upper_bound(_checkpoints, offset) - _checkpoints.begin() -
+        1;
+    return checkpoint * _stride +
+           static_cast<size_t>(
+               std::count(_body.begin() + _checkpoints[checkpoint],
+                          _body.begin() + offset, '\n'));
+  }
+
+  // Keeps a screenful of lines below the top one, indexing as far as needed
+  void _clamp() {
+    const size_t last_needed = _top + _visible;
+    if (last_needed > _head.size()) {
+      _index_until(last_needed - _head.size(), _all);
+    }
+    const size_t total = _head.size() + _lines;
+    _top = std::min(_top, total > _visible ? total - _visible : 0);
+  }
+
+  // Scrolls body line `line` into view, a third of the way down when it
+  // wasn't already
+  void _show_line(const size_t line) {
+    const size_t target = _head.size() + line;
+    if (target < _top || target >= _top + _visible) {
+      _top = target - std::min(target, _visible / 3);
+    }
+  }
+
+  // Scrolls byte `offset` into view, which may sit far along a long line
+  void _show_offset(const size_t offset) {
+    const size_t line = _line_of(offset);
+    _show_line(line);
+
+    const size_t column = offset - _line_start(line);
+    if (column < _left || column >= _left + 2 * _horizontal_step) {
+      _left = column > _horizontal_step ? column - _horizontal_step : 0;
+    }
+  }
+
+  void _prompt_key(const int key) {
+    if (key == '\n') {
+      const char prompt = *_prompt;
+      _prompt.reset();
+      if (prompt == '/') {
+        if (!_input.empty()) {
+          _query = std::move(_input);
+          _match.reset();
+          _search(true);
+        }
+      } else {
+        _jump(prompt == '@');
+      }
+    } else if (key == '\033') {
+      _prompt.reset();
+    } else if (key == 127 || key == '\b') {
+      if (!_input.empty()) {
+        _input.pop_back();
+      } else if (_prompt == '@') {
+        _prompt = ':';
+      }
+    } else if (key == '@' && _prompt == ':' && _input.empty()) {
+      _prompt = '@';
+    } else if (key >= ' ' && key < 127) {
+      _input += static_cast<char>(key);
+    }
+  }
+
+  // `:N` goes to body line N, `:@N` to the line holding byte offset N
+  void _jump(const bool to_offset) {
+    size_t number = 0;
+    const auto [end, error] =
+        std::from_chars(_input.data(), _input.data() + _input.size(), number);
+    if (error != std::errc() || end != _input.data() + _input.size() ||
+        (!to_offset && number == 0)) {
+      _status = std::format("Not a {}: {}", to_offset ? "byte offset" : "line",
+                            _input);
+      return;
+    }
+
+    if (_body.empty()) {
+      return;
+    }
+
+    if (to_offset) {
+      if (number >= _body.size()) {
+        _status = std::format("The body is {} bytes long.", _body.size());
+        number = _body.size() - 1;
+      }
+      _show_offset(number);
+      return;
+    }
+
+    _index_until(number - 1, _all);
+    if (number > _lines) {
+      _status = std::format("The body has {} lines.", _lines);
+      number = _lines;
+    }
+    _show_line(number - 1);
+  }
+
+  // Looks for `_query` after the current match, or before it, from the top
+  // of the screen when there is none, wrapping around once
+  void _search(const bool forward) {
+    // The lines on screen were indexed when it was drawn
+    size_t from = 0;
+    if (_match) {
+      from = *_match + (forward ? 1 : 0);
+    } else if (_top > _head.size() && _top - _head.size() < _lines) {
+      from = _line_start(_top - _head.size());
+    }
+
+    auto found = forward ? _find(from, _body.size()) : _find_last(from);
+    if (!found) {
+      found = forward ? _find(0, from) : _find_last(_body.size());
+      if (found) {
+        _status = std::format("Search wrapped: {}", _query);
+      }
+    }
+    if (!found) {
+      _status = std::format("Not found: {}", _query);
+      return;
+    }
+
+    _match = found;
+    _show_offset(*found);
+  }
+
+  // First match starting in [from, to)
+  std::optional<size_t> _find(const size_t from, const size_t to) const {
+    const size_t end = std::min(_body.size(), to + _query.size() - 1);
+    if (from >= end) {
+      return std::nullopt;
+    }
+    const auto first = _body.begin() + from;
+    const auto last = _body.begin() + end;
+    const auto it = std::search(
+        first, last,
+        std::boyer_moore_horspool_searcher(_query.begin(), _query.end()));
+    return it == last ? std::nullopt
+                      : std::optional(static_cast<size_t>(it - _body.begin()));
+  }
+
+  // Last match starting before `before`, searching backwards for the
+  // reversed query
+  std::optional<size_t> _find_last(const size_t before) const {
+    const size_t end = std::min(_body.size(), before + _query.size() - 1);
+    const std::string reversed(_query.rbegin(), _query.rend());
+    const auto first = _body.rbegin() + (_body.size() - end);
+    const auto it = std::search(
+        first, _body.rend(),
+        std::boyer_moore_horspool_searcher(reversed.begin(), reversed.end()));
+    if (it == _body.rend()) {
+      return std::nullopt;
+    }
+    return static_cast<size_t>(_body.rend() - it) - _query.size();
+  }
+};
+
+template <typename R>
+concept ConvertibleToStringViewRange =
+    std::ranges::range<R> &&
+    std::convertible_to<std::ranges::range_reference_t<R>, std::string_view>;
+
+// HTTP Request Parser with variable support. Every parse gets its own
+// ParseContext, so a parser, or several, can be used from many threads.
+class HttpRequestParser {
+public:
+  // `environment` sits under the variables declared in the parsed text
+  explicit HttpRequestParser(
+      std::shared_ptr<const Environment> environment = nullptr)
+      : _environment(std::move(environment)) {}
+
+  // With `jobs` > 1, the file is split on `###` separators and the pieces
+  // are parsed on that many threads, see _parse_parallel.
+  ParsedCollection parse_file(const std::string_view filename,
+                              size_t jobs = 1) const {
+    auto reader = create_mmap_reader((std::string(filename)));
+
+    if (!reader->is_open()) {
+      std::println(stderr, "Error: Could not open file {}", filename);
+      return ParsedCollection();
+    }
+
+    // `base_directory` anchors relative paths found in the requests, like
+    // the targets of `>> path`
+    const auto base_directory = std::filesystem::path(filename).parent_path();
+    ParsedCollection collection(std::move(reader), _environment);
+    const MmapReader &mapping = *collection.mapping();
+
+    if (jobs > 1) {
+      _parse_parallel(collection, mapping, base_directory, jobs);
     } else {
-      for (int i = 0; i < static_cast<int>(_requests.size()); i++) {
-        if (i == _selected) {
-          std::print("> ");
-        } else {
-          std::print("  ");
+      _parse_contents(collection, mapping, base_directory);
+    }
+
+    return collection;
+  }
+
+  ParsedCollection parse_string(std::string string_content) const {
+    ParsedCollection collection(std::move(string_content), _environment);
+    const std::string_view text = collection.text();
+
+    // Same line index as mapped files, so `\r\n` is handled alike
+    std::vector<size_t> line_starts;
+    index_lines(text.data(), text.size(), line_starts);
+
+    _parse_contents(
+        collection,
+        std::ranges::subrange(
+            MmapReader::LineIterator(text.data(), line_starts.data()),
+            MmapReader::LineIterator(text.data(), line_starts.data() +
+                                                      line_starts.size() - 1)),
+        {});
+
+    return collection;
+  }
+
+  // --watch: parses `text` like parse_string, but carries the requests of
+  // `previous` over instead of parsing them again when their span is
+  // byte-identical, in the unchanged head or tail of the text, and starts
+  // from the same variables and pending directives. Only the edited part
+  // of a collection is parsed after a save. The result records its spans,
+  // so it can be the `previous` of the next reparse in turn.
+  ParsedCollection reparse(std::string text,
+                           const std::filesystem::path &base_directory,
+                           ParsedCollection previous = {}) const {
+    ParsedCollection collection(std::move(text), _environment);
+    const std::string_view current = collection.text();
+    const std::string_view before = previous.text();
+
+    std::vector<size_t> line_starts;
+    index_lines(current.data(), current.size(), line_starts);
+    const size_t line_count = line_starts.size() - 1;
+    auto line_at = [&](const size_t index) -> std::string_view {
+      return *MmapReader::LineIterator(current.data(),
+                                       line_starts.data() + index);
+    };
+
+    // Nothing is reused across environments
+    const bool reusable = previous.environment() == _environment;
+    const size_t prefix = reusable ? _common_prefix(current, before) : 0;
+    const size_t suffix =
+        reusable ? _common_suffix(current, before,
+                                  std::min(current.size(), before.size()) -
+                                      prefix)
+                 : 0;
+
+    auto [old_requests, old_spans] = previous.take_requests();
+
+    ParseContext context(_environment);
+    ParseState state;
+    state.context = &context;
+    state.arena = collection.new_arena();
+    state.requests.reserve(old_requests.size());
+
+    // Reused requests view the old text and were carved from the old
+    // arenas. Their copies view the same bytes in the unchanged head or tail
+    // of the new text, and anything else is copied to the new arena, so
+    // nothing of `previous` outlives this parse.
+    auto rebase = [&](const std::string_view view) -> std::string_view {
+      if (view.empty()) {
+        return view;
+      }
+      if (std::less_equal<>()(before.data(), view.data()) &&
+          std::less_equal<>()(view.data() + view.size(),
+                              before.data() + before.size())) {
+        const size_t offset = view.data() - before.data();
+        if (offset + view.size() <= prefix) {
+          return current.substr(offset, view.size());
+        }
+        if (offset >= before.size() - suffix) {
+          return current.substr(offset + current.size() - before.size(),
+                                view.size());
+        }
+      }
+      char *copy = static_cast<char *>(state.arena->allocate(view.size(), 1));
+      std::ranges::copy(view, copy);
+      return std::string_view(copy, view.size());
+    };
+
+    std::vector<ParsedCollection::Span> spans;
+    spans.reserve(old_requests.size());
+
+    // The span of `offset`, if the old text has it at the same place in
+    // the head, or shifted in the tail. Usually the one after the last span
+    // found.
+    size_t next_old_span = 0;
+    auto find_old_span = [&](const size_t offset) -> std::optional<size_t> {
+      size_t old_offset;
+      if (offset < prefix) {
+        old_offset = offset;
+      } else if (offset >= current.size() - suffix) {
+        old_offset = offset - current.size() + before.size();
+      } else {
+        return std::nullopt;
+      }
+
+      if (next_old_span < old_spans.size() &&
+          old_spans[next_old_span].offset == old_offset) {
+        return next_old_span++;
+      }
+
+      const auto it = std::ranges::lower_bound(
+          old_spans, old_offset, {}, &ParsedCollection::Span::offset);
+      if (it == old_spans.end() || it->offset != old_offset) {
+        return std::nullopt;
+      }
+      next_old_span = it - old_spans.begin() + 1;
+      return it - old_spans.begin();
+    };
+
+    // Records the directives the closing span leaves pending
+    auto close_span = [&] {
+      if (spans.empty()) {
+        return;
+      }
+      auto &span = spans.back();
+      span.exit_name_offset =
+          state.name.empty()
+              ? 0
+              : static_cast<uint32_t>(state.name.data() - current.data() -
+                                      span.offset);
+      span.exit_name_length = static_cast<uint32_t>(state.name.size());
+      span.exit_gzip = state.gzip;
+    };
+
+    size_t line = 0;
+    // The lines before the first request are always parsed again
+    for (; line < line_count && !_is_request_line(line_at(line)); line++) {
+      _parse_line(state, line_at(line), base_directory, true);
+    }
+
+    while (line < line_count) {
+      close_span();
+
+      ParsedCollection::Span &span = spans.emplace_back();
+      span.offset = line_starts[line];
+      span.context = context.fingerprint();
+
+      const auto index = find_old_span(span.offset);
+      const auto end_line =
+          index ? _reusable_end(*index, old_spans, old_requests, span, state,
+                                current, before, prefix, line_starts, line)
+                : std::nullopt;
+
+      if (end_line) {
+        const auto &old = old_spans[*index];
+
+        _save_current_request(state);
+        state.requests.push_back(_rebase(old_requests[*index], state.name,
+                                         rebase, state.arena));
+
+        span.declarations = old.declarations;
+        span.reused = true;
+        if (old.declarations) {
+          for (; line < *end_line; line++) {
+            if (const std::string_view next = line_at(line);
+                next.starts_with('@')) {
+              _parse_variable(context, next);
+            }
+          }
+        }
+        line = *end_line;
+
+        state.name = current.substr(span.offset + old.exit_name_offset,
+                                    old.exit_name_length);
+        state.gzip = old.exit_gzip;
+        continue;
+      }
+
+      _parse_line(state, line_at(line), base_directory, true);
+      for (line++; line < line_count; line++) {
+        const std::string_view next = line_at(line);
+        if (_is_request_line(next)) {
+          break;
+        }
+        span.declarations = span.declarations || next.starts_with('@');
+        _parse_line(state, next, base_directory, true);
+      }
+    }
+
+    close_span();
+    _save_current_request(state);
+
+    collection.set_requests(std::move(state.requests));
+    collection.set_spans(std::move(spans));
+    return collection;
+  }
+
+private:
+  std::shared_ptr<const Environment> _environment;
+
+  // Bytes `a` and `b` share from the start, compared a page at a time
+  static size_t _common_prefix(const std::string_view a,
+                               const std::string_view b) {
+    constexpr size_t page = 4096;
+    const size_t size = std::min(a.size(), b.size());
+    size_t at = 0;
+
+    while (at + page <= size &&
+           std::memcmp(a.data() + at, b.data() + at, page) == 0) {
+      at += page;
+    }
+    while (at < size && a[at] == b[at]) {
+      at++;
+    }
+    return at;
+  }
+
+  // Bytes `a` and `b` share from the end, up to `limit`
+  static size_t _common_suffix(const std::string_view a,
+                               const std::string_view b, const size_t limit) {
+    constexpr size_t page = 4096;
+    const char *a_end = a.data() + a.size();
+    const char *b_end = b.data() + b.size();
+    size_t at = 0;
+
+    while (at + page <= limit &&
+           std::memcmp(a_end - at - page, b_end - at - page, page) == 0) {
+      at += page;
+    }
+    while (at < limit && a_end[-1 - static_cast<ptrdiff_t>(at)] ==
+                             b_end[-1 - static_cast<ptrdiff_t>(at)]) {
+      at++;
+    }
+    return at;
+  }
+
+  // Where the line-by-line state machine stands. Requests are built in
+  // place, the last one stays open while `open` is set.
+  struct ParseState {
+    ParseContext *context = nullptr;
+    std::pmr::memory_resource *arena = nullptr;
+    std::vector<HttpRequest> requests;
+    bool open = false;
+    bool in_headers = false;
+    bool in_body = false;
+    // Directives waiting for the next request line
+    std::string_view name;
+    bool gzip = false;
+    // Joined only when the request is closed, usually as a single view
+    std::vector<std::string_view> body_lines;
+  };
+
+  // Line ending the span of the old request `index` in the new text, when
+  // that request can be reused for `span`: the span must be the same bytes
+  // up to the next request line (or the end), and start from the same
+  // variables and pending directives.
+  static std::optional<size_t>
+  _reusable_end(const size_t index,
+                const std::span<const ParsedCollection::Span> old_spans,
+                const std::span<const HttpRequest> old_requests,
+                const ParsedCollection::Span &span, const ParseState &state,
+                const std::string_view current, const std::string_view before,
+                const size_t prefix, const std::vector<size_t> &line_starts,
+                const size_t line) {
+    const auto &old = old_spans[index];
+    const auto &request = old_requests[index];
+    if (old.context != span.context || request.name != state.name ||
+        request.gzip_body != state.gzip) {
+      return std::nullopt;
+    }
+
+    const size_t old_end = index + 1 < old_spans.size()
+                               ? old_spans[index + 1].offset
+                               : before.size();
+    size_t end = old_end;
+    if (span.offset >= prefix) {
+      // In the tail, everything from the span on is unchanged
+      end = old_end + current.size() - before.size();
+    } else if (old_end > prefix) {
+      return std::nullopt;
+    }
+
+    // Spans are mostly a few lines long, so gallop before bisecting
+    size_t first = line + 1;
+    size_t step = 1;
+    while (first + step < line_starts.size() &&
+           line_starts[first + step] < end) {
+      first += step;
+      step *= 2;
+    }
+    const auto it = std::lower_bound(
+        line_starts.begin() + first,
+        line_starts.begin() + std::min(first + step + 1, line_starts.size()),
+        end);
+    if (it == line_starts.end() || *it != end) {
+      return std::nullopt;
+    }
+
+    const size_t end_line = it - line_starts.begin();
+    if (end_line + 1 < line_starts.size() &&
+        !_is_request_line(*MmapReader::LineIterator(current.data(), &*it))) {
+      return std::nullopt;
+    }
+    return end_line;
+  }
+
+  // Copy of `request` carried over by reparse, under its new `name`
+  static HttpRequest _rebase(const HttpRequest &request,
+                             const std::string_view name, const auto &rebase,
+                             std::pmr::memory_resource *arena) {
+    HttpRequest copy(request.method, request.url.rebased(rebase, arena), name,
+                     arena);
+    copy.headers.reserve(request.headers.size());
+    for (const auto &[key, value] : request.headers) {
+      copy.headers.push_back(
+          {.key = rebase(key), .value = value.rebased(rebase, arena)});
+    }
+    copy.set_body(request.body.rebased(rebase, arena));
+    copy.body_file = request.body_file;
+    copy.gzip_body = request.gzip_body;
+    copy.response_redirect = request.response_redirect;
+    copy.http_version = request.http_version;
+    return copy;
+  }
+
+  // The lines must view the collection's text
+  void _parse_contents(ParsedCollection &collection,
+                       ConvertibleToStringViewRange auto &&range,
+                       const std::filesystem::path &base_directory) const {
+    ParseContext context(_environment);
+    ParseState state;
+    state.context = &context;
+    state.arena = collection.new_arena();
+    // Sized upfront: growing the array would briefly hold two copies of it
+    state.requests.reserve(std::ranges::count_if(range, _is_request_line));
+
+    for (std::string_view line : range) {
+      _parse_line(state, line, base_directory, true);
+    }
+
+    // Add the last request if exists
+    _save_current_request(state);
+
+    collection.set_requests(std::move(state.requests));
+  }
+
+  static bool _is_request_line(const std::string_view line) {
+    return line.find("GET ") == 0 || line.find("POST ") == 0 ||
+           line.find("PUT ") == 0 || line.find("PATCH ") == 0 ||
+           line.find("DELETE ") == 0;
+  }
+
+  // Closes the request being parsed, if any
+  static void _save_current_request(ParseState &state) {
+    if (state.open) {
+      if (state.in_body && !state.body_lines.empty()) {
+        state.requests.back().set_body(
+            _compile(_join_lines(state.body_lines, state.arena), state));
+      }
+      state.open = false;
+    }
+  }
+
+  // Body lines are usually consecutive lines of the source, then the body is
+  // just a view spanning them. Skipped lines (comments, blank lines) or
+  // `\r\n` endings in between force a copy into the arena.
+  static std::string_view
+  _join_lines(const std::vector<std::string_view> &lines,
+              std::pmr::memory_resource *arena) {
+    size_t size = lines.front().size();
+    bool contiguous = true;
+
+    for (size_t i = 1; i < lines.size(); i++) {
+      const auto &previous = lines[i - 1];
+      contiguous = contiguous &&
+                   lines[i].data() == previous.data() + previous.size() + 1 &&
+                   previous.data()[previous.size()] == '\n';
+      size += 1 + lines[i].size();
+    }
+
+    if (contiguous) {
+      return std::string_view(lines.front().data(), size);
+    }
+
+    char *joined = static_cast<char *>(arena->allocate(size, 1));
+    char *out = joined;
+    for (const auto &line : lines) {
+      if (out != joined) {
+        *out++ = '\n';
+      }
+      out = std::ranges::copy(line, out).out;
+    }
+
+    return std::string_view(joined, size);
+  }
+
+  // Variable declarations are only recorded when `collect_variables` is set,
+  // parallel parses collect them upfront instead.
+  static void _parse_line(ParseState &state, std::string_view line,
+                          const std::filesystem::path &base_directory,
+                          bool collect_variables) {
+    HttpRequest *current_request =
+        state.open ? &state.requests.back() : nullptr;
+
+    if (line.starts_with("# @name")) {
+      constexpr auto nameSize = string_length("# @name");
+      state.name = line.substr(std::min(nameSize + 1, line.size()));
+      return;
+    }
+
+    if (_trim_whitespace(line) == "# @gzip") {
+      state.gzip = true;
+      return;
+    }
+
+    // Skip comments
+    if (line.starts_with("#") || line.starts_with("//")) {
+      return;
+    }
+
+    // Parse variable declarations
+    if (line.find("@") == 0) {
+      if (collect_variables) {
+        _parse_variable(*state.context, line);
+      }
+      return;
+    }
+
+    // Skip empty lines
+    if (line.empty()) {
+      if (current_request && state.in_headers) {
+        state.in_headers = false;
+        state.in_body = true;
+        state.body_lines.clear();
+        state.name = {};
+        state.gzip = false;
+      }
+      return;
+    }
+
+    // Check if it's a new request (starts with HTTP method)
+    if (_is_request_line(line)) {
+      // Save previous request if exists
+      _save_current_request(state);
+
+      // Parse method and URL, compiling the variables of the URL
+      size_t space_pos = line.find(' ');
+      std::string_view target = _trim_whitespace(line.substr(space_pos + 1));
+      const HttpVersion version = _split_http_version(target);
+
+      // Create new request
+      state.requests.emplace_back(line.substr(0, space_pos),
+                                  _compile(target, state), state.name,
+                                  state.arena);
+      state.requests.back().gzip_body = state.gzip;
+      state.requests.back().http_version = version;
+      state.open = true;
+      state.in_headers = true;
+      state.in_body = false;
+      state.body_lines.clear();
+      state.name = {};
+      state.gzip = false;
+    }
+    // Response redirect, `>> path` or `>>! path` (overwrite)
+    else if (current_request &&
+             (line.starts_with(">> ") || line.starts_with(">>! "))) {
+      const bool overwrite = line.starts_with(">>!");
+      const std::filesystem::path target =
+          _compile(_trim_whitespace(line.substr(overwrite ? 3 : 2)), state)
+              .render();
+
+      current_request->response_redirect = ResponseRedirect{
+          .path = target.is_relative() ? base_directory / target : target,
+          .overwrite = overwrite};
+    }
+    // Parse headers
+    else if (state.in_headers && current_request) {
+      size_t colon_pos = line.find(':');
+      if (colon_pos != std::string::npos) {
+        std::string_view key = line.substr(0, colon_pos);
+        std::string_view value = line.substr(colon_pos + 1);
+
+        std::string_view trimmed_key = _trim_whitespace(key);
+        std::string_view trimmed_value = _trim_whitespace(value);
+
+        current_request->add_header(trimmed_key,
+                                    _compile(trimmed_value, state));
+      }
+    }
+    // Body read from a file, `< path`, only valid as the whole body. Text
+    // after it still lands in the body, which the file overrides, so the
+    // app can warn about it.
+    else if (state.in_body && current_request && state.body_lines.empty() &&
+             !current_request->body_file && line.starts_with("< ")) {
+      const std::filesystem::path source =
+          _compile(_trim_whitespace(line.substr(2)), state).render();
+
+      current_request->body_file =
+          source.is_relative() ? base_directory / source : source;
+    }
+    // Parse body, compiled once the whole body is known
+    else if (state.in_body && current_request) {
+      state.body_lines.push_back(line);
+    }
+  }
+
+  // A slice of the file handed to one worker, in whole lines. It always
+  // starts at a `###` separator (or the top of the file).
+  struct ParseTask {
+    size_t first_line = 0;
+    size_t last_line = 0;
+    // First request line of the slice; the lines before it still belong to
+    // the request of the previous slice and are replayed in order.
+    size_t first_request_line = 0;
+    ParseState state;
+  };
+
+  // Variable declarations are gathered by a sequential pre-scan, so they are
+  // file-wide here: a variable used before its declaration resolves too.
+  // Everything else matches the sequential parse, since each slice's leading
+  // lines and trailing request state are stitched back in file order.
+  void _parse_parallel(ParsedCollection &collection, const MmapReader &reader,
+                       const std::filesystem::path &base_directory,
+                       size_t jobs) const {
+    ParseContext context(_environment);
+
+    const size_t line_count = reader.line_count();
+    std::vector<size_t> separators;
+
+    // Request lines seen before each separator, to size the arrays
+    std::vector<size_t> requests_before;
+    size_t request_count = 0;
+
+    for (size_t index = 0; std::string_view line : reader.lines(0, line_count)) {
+      if (line.starts_with('@')) {
+        _parse_variable(context, line);
+      } else if (line.starts_with("###") && index > 0) {
+        separators.push_back(index);
+        requests_before.push_back(request_count);
+      } else if (_is_request_line(line)) {
+        request_count++;
+      }
+      index++;
+    }
+
+    // Several separators per task, so scheduling doesn't dominate when the
+    // file is made of thousands of tiny requests
+    const size_t lines_per_task =
+        std::max<size_t>(1024, line_count / (jobs * 8));
+    std::vector<ParseTask> tasks;
+    size_t task_start = 0;
+    size_t task_requests = 0;
+
+    for (size_t i = 0; i < separators.size(); i++) {
+      if (separators[i] - task_start >= lines_per_task) {
+        tasks.push_back(
+            {.first_line = task_start, .last_line = separators[i], .state = {}});
+        tasks.back().state.requests.reserve(requests_before[i] - task_requests);
+        task_start = separators[i];
+        task_requests = requests_before[i];
+      }
+    }
+    tasks.push_back(
+        {.first_line = task_start, .last_line = line_count, .state = {}});
+    tasks.back().state.requests.reserve(request_count - task_requests);
+
+    std::atomic<size_t> next_task = 0;
+    {
+      std::vector<std::jthread> workers;
+      for (size_t i = 0; i < std::min(jobs, tasks.size()); i++) {
+        workers.emplace_back([&, arena = collection.new_arena()] {
+          for (size_t index = next_task++; index < tasks.size();
+               index = next_task++) {
+            tasks[index].state.context = &context;
+            tasks[index].state.arena = arena;
+            _parse_task(reader, tasks[index], base_directory);
+          }
+        });
+      }
+    }
+
+    ParseState merged;
+    merged.context = &context;
+    merged.arena = collection.new_arena();
+    merged.requests.reserve(request_count);
+
+    for (auto &task : tasks) {
+      for (std::string_view line :
+           reader.lines(task.first_line, task.first_request_line)) {
+        _parse_line(merged, line, base_directory, false);
+      }
+
+      if (task.first_request_line == task.last_line) {
+        continue;
+      }
+
+      // What the sequential parse does on a request line: close the pending
+      // request and hand the pending directives over to the new one
+      _save_current_request(merged);
+      task.state.requests.front().name = merged.name;
+      task.state.requests.front().gzip_body = merged.gzip;
+
+      merged.requests.insert(
+          merged.requests.end(),
+          std::make_move_iterator(task.state.requests.begin()),
+          std::make_move_iterator(task.state.requests.end()));
+      merged.open = task.state.open;
+      merged.in_headers = task.state.in_headers;
+      merged.in_body = task.state.in_body;
+      merged.name = task.state.name;
+      merged.gzip = task.state.gzip;
+      merged.body_lines = std::move(task.state.body_lines);
+    }
+
+    _save_current_request(merged);
+
+    collection.set_requests(std::move(merged.requests));
+  }
+
+  // Leaves the last request of the slice open, the next slice may continue it
+  static void _parse_task(const MmapReader &reader, ParseTask &task,
+                          const std::filesystem::path &base_directory) {
+    task.first_request_line = task.last_line;
+
+    for (size_t index = task.first_line;
+         std::string_view line : reader.lines(task.first_line, task.last_line)) {
+      if (task.first_request_line == task.last_line) {
+        if (!_is_request_line(line)) {
+          index++;
+          continue;
+        }
+        task.first_request_line = index;
+      }
+
+      _parse_line(task.state, line, base_directory, false);
+      index++;
+    }
+  }
+
+  // Takes a trailing ` HTTP/x` off `target`, if any
+  static HttpVersion _split_http_version(std::string_view &target) {
+    for (const auto &[version, name] : http_version_names) {
+      const auto rest = target.substr(0, target.size() - name.size());
+      if (target.size() > name.size() && target.ends_with(name) &&
+          (rest.back() == ' ' || rest.back() == '\t')) {
+        target = _trim_whitespace(rest);
+        return version;
+      }
+    }
+
+    return HttpVersion::unspecified;
+  }
+
+  static std::string_view _trim_whitespace(const std::string_view string) {
+    size_t start = string.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+      return std::string_view(); // Empty string
+    }
+
+    size_t end = string.find_last_not_of(" \t");
+    return string.substr(start, end - start + 1);
+  }
+
+  // Parse a variable declaration line
+  static void _parse_variable(ParseContext &context,
+                              const std::string_view line) {
+    // Remove leading @
+    std::string_view var_line = line.substr(1);
+
+    // Find the equal sign
+    size_t equal_pos = var_line.find('=');
+    if (equal_pos == std::string::npos) {
+      return; // Invalid variable declaration
+    }
+
+    // Extract variable name and value
+    std::string_view var_name = _trim_whitespace(var_line.substr(0, equal_pos));
+    std::string_view var_value =
+        _trim_whitespace(var_line.substr(equal_pos + 1));
+
+    // Handle quoted strings
+    if (var_value.size() >= 2 && var_value.front() == '"' &&
+        var_value.back() == '"') {
+      var_value = var_value.substr(1, var_value.length() - 2);
+    }
+
+    // Store the variable, both views into the parsed text
+    context.declare(var_name, var_value);
+  }
+
+  // Splits `{{...}}` placeholders out of a string, without using regex
+  static RequestTemplate _compile(const std::string_view input,
+                                  const ParseState &state) {
+    return RequestTemplate::compile(input, *state.context, state.arena);
+  }
+};
+
+// Latency histogram in the spirit of HdrHistogram: values are bucketed by
+// power of two, and every bucket is split into 1024 linear sub-buckets, so
+// any recorded value is kept with three significant digits of precision
+// using a fixed amount of memory, no matter how many samples come in.
+class LatencyHistogram {
+public:
+  LatencyHistogram() : _counts((_bucket_count + 1) * _sub_bucket_half_count) {}
+
+  void record(std::chrono::microseconds latency) {
+    const uint64_t value = std::min<uint64_t>(
+        static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0)),
+        _highest_trackable_value);
+
+    _counts[_index_of(value)]++;
+    _total_count++;
+    _max = std::max(_max, value);
+  }
+
+  // Highest value (up to the histogram precision) below which `percentile`
+  // percent of the recorded values fall.
+  std::chrono::microseconds value_at_percentile(double percentile) const {
+    if (_total_count == 0) {
+      return std::chrono::microseconds(0);
+    }
+
+    const auto target = std::max<uint64_t>(
+        1, static_cast<uint64_t>(std::ceil(percentile / 100.0 *
+                                           static_cast<double>(_total_count))));
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < _counts.size(); i++) {
+      seen += _counts[i];
+      if (seen >= target) {
+        return std::chrono::microseconds(
+            std::min(_highest_equivalent_value(i), _max));
+      }
+    }
+
+    return std::chrono::microseconds(_max);
+  }
+
+  std::chrono::microseconds max() const {
+    return std::chrono::microseconds(_max);
+  }
+
+  uint64_t count() const { return _total_count; }
+
+private:
+  static constexpr int _sub_bucket_half_count_magnitude = 10;
+  static constexpr uint64_t _sub_bucket_half_count =
+      uint64_t{1} << _sub_bucket_half_count_magnitude;
+  static constexpr uint64_t _sub_bucket_mask =
+      (_sub_bucket_half_count << 1) - 1;
+  // Roughly 12 days worth of microseconds, far beyond any sane timeout
+  static constexpr int _bucket_count = 30;
+  static constexpr uint64_t _highest_trackable_value =
+      (uint64_t{1} << (_bucket_count + _sub_bucket_half_count_magnitude)) - 1;
+
+  static size_t _index_of(uint64_t value) {
+    const int bucket =
+        std::bit_width(value | _sub_bucket_mask) -
+        (_sub_bucket_half_count_magnitude + 1);
+    const uint64_t sub_bucket = value >> bucket;
+
+    return ((bucket + 1) << _sub_bucket_half_count_magnitude) +
+           (sub_bucket - _sub_bucket_half_count);
+  }
+
+  static uint64_t _highest_equivalent_value(size_t index) {
+    int bucket = static_cast<int>(index >> _sub_bucket_half_count_magnitude) - 1;
+    uint64_t sub_bucket =
+        (index & (_sub_bucket_half_count - 1)) + _sub_bucket_half_count;
+
+    if (bucket < 0) {
+      sub_bucket -= _sub_bucket_half_count;
+      bucket = 0;
+    }
+
+    return (sub_bucket << bucket) + (uint64_t{1} << bucket) - 1;
+  }
+
+  std::vector<uint64_t> _counts;
+  uint64_t _total_count = 0;
+  uint64_t _max = 0;
+};
+
+struct LoadRequestOptions {
+  bool should_eval = false;
+  bool should_feed_from_stdin = false;
+  bool show_help = false;
+  bool run_all = false;
+  bool batch = false;
+  std::optional<short> pick_index;
+  std::optional<size_t> parallel;
+  std::optional<size_t> repeat;
+  std::optional<size_t> concurrency;
+  std::optional<size_t> parse_threads;
+  std::optional<std::string> environment;
+  std::optional<uint64_t> seed;
+  bool warmup = false;
+  bool parse_cache = false;
+  bool watch = false;
+  // --watch-check
+  bool check_reparse = false;
+  // --cache / --cache-dir
+  std::optional<std::filesystem::path> cache_directory;
+  // `host:port:addr` entries of --resolve
+  std::vector<std::string> resolve;
+  std::string eval_string;
+  std::string request_file;
+};
+
+// Main application
+class HttpRequestApp {
+public:
+  explicit HttpRequestApp(const LoadRequestOptions &options)
+      : _adapter(std::make_unique<CurlAdapter>(options.resolve)),
+        _warmup(options.warmup) {}
+
+  bool load_requests(const LoadRequestOptions &options) {
+    std::shared_ptr<const Environment> environment;
+
+    if (options.cache_directory) {
+      auto cache = ResponseCache::open(*options.cache_directory);
+      if (!cache) {
+        std::println(stderr, "{}", cache.error().message);
+        return false;
+      }
+      _cache = std::move(*cache);
+      _adapter->set_response_cache(_cache.get());
+    }
+
+    // Environment files sit next to the request file, or in the working
+    // directory for --eval and --stdin
+    if (options.environment) {
+      auto loaded = Environment::load(
+          std::filesystem::path(options.request_file).parent_path(),
+          *options.environment);
+      if (!loaded) {
+        std::println(stderr, "{}", loaded.error().message);
+        return false;
+      }
+      environment = std::make_shared<const Environment>(std::move(*loaded));
+    }
+
+    const HttpRequestParser parser(environment);
+    std::optional<ParseCache> parse_cache;
+    if (options.parse_cache) {
+      parse_cache.emplace();
+    }
+    // Parsed in parallel, variables apply file-wide
+    const bool parallel_parse = options.parse_threads.value_or(1) > 1;
+
+    if (options.watch) {
+      _request_file = options.request_file;
+      _environment_name = options.environment;
+      _environment = environment;
+      _check_reparse = options.check_reparse;
+
+      auto text = _read_file(options.request_file);
+      if (!text) {
+        return false;
+      }
+      _collection = parser.reparse(
+          std::move(*text),
+          std::filesystem::path(options.request_file).parent_path());
+
+      _watcher = create_file_watcher();
+      _watcher->watch(_watched_files());
+    } else if (auto cached =
+                   parse_cache ? parse_cache->load(options.request_file,
+                                                   environment, parallel_parse)
+                               : std::nullopt) {
+      _collection = std::move(*cached);
+    } else {
+      _collection =
+          options.should_feed_from_stdin
+              ? parser.parse_string(_collect_stream_lines(std::cin))
+          : options.should_eval
+              ? parser.parse_string(options.eval_string)
+              : parser.parse_file(options.request_file,
+                                  options.parse_threads.value_or(1));
+
+      if (parse_cache && !_collection.empty()) {
+        parse_cache->store(options.request_file, _collection, environment,
+                           parallel_parse);
+      }
+    }
+
+    if (_collection.empty()) {
+      std::println(stderr, "No valid requests found.");
+      return false;
+    }
+
+    _menu.set_requests(_collection.requests());
+    for (const auto &warning : _index_requests()) {
+      std::println(stderr, "{}", warning);
+    }
+
+    return true;
+  }
+
+  void run() {
+    if (_menu.size() == 0) {
+      std::println("No requests to display. Exiting.");
+      return;
+    }
+
+    auto input = create_terminal_input();
+    TerminalRenderer screen(create_terminal_screen());
+    _menu.build_index();
+
+    while (true) {
+      _menu.display(screen);
+
+      // Between key presses the progress of the requests sent is followed,
+      // and with --watch saves to the watched files reload the menu in place.
+      // The frame is drawn again only after one of those or a resize changed
+      // it.
+      while (!input->wait_for_key(_watch_interval)) {
+        bool changed = screen.resized();
+        if (!_watcher) {
+          // Nothing to do
+        } else if (const auto reloaded = _reload(_watcher->wait({}));
+                   !reloaded) {
+          _menu.set_status(reloaded.error().message);
+          changed = true;
+        } else if (!reloaded->empty()) {
+          _menu.set_status(*reloaded);
+          _stop_dependencies();
+          changed = true;
         }
+        if (_update_sent() || changed) {
+          _menu.display(screen);
+        }
+      }
 
-        if (!_requests[i]->name.empty()) {
-          std::println("# {}", _requests[i]->name);
-          std::print("    ");
+      int key = input->get_key();
+
+      // Handle special keys
+      if (_menu.filtering() && key != 1 && key != 2) {
+        if (key == '\n') {
+          _menu.accept_filter();
+        } else if (key == '\033') { // Escape
+          _menu.clear_filter();
+        } else if (key == 127 || key == '\b') { // Backspace
+          _menu.filter_erase();
+        } else if (key >= ' ' && key < 127) {
+          _menu.filter_append(static_cast<char>(key));
+        }
+      } else if (key == 1) { // Up arrow
+        _menu.move_up();
+      } else if (key == 2) { // Down arrow
+        _menu.move_down();
+      } else if (key == 'q' || key == 'Q') {
+        break;
+      } else if (key == 'd' || key == 'D') {
+        _menu.toggle_details();
+      } else if (key == '/') {
+        _menu.start_filter();
+      } else if (key == '\033') { // Escape
+        _menu.clear_filter();
+      } else if (key == 'c' || key == 'C') {
+        _cancel_latest();
+      } else if (key >= '1' && key <= '9') {
+        if (const size_t number = key - '0';
+            number <= _sent.size() && _sent[number - 1].finished()) {
+          _show_sent(_sent[number - 1], screen, *input);
+        }
+      } else if (key == '\n') { // Enter key
+        if (auto request = _menu.get_selected()) {
+          _send(static_cast<size_t>(request - _menu.requests().data()));
         }
-        std::println("{} {}", _requests[i]->method, _requests[i]->url);
       }
 
-      std::println("\nPress 'd' to toggle details, arrow keys to navigate, "
-                   "Enter to select, q to quit.");
+      _update_sent();
+    }
+
+    // Requests still in flight are abandoned
+    for (auto &sent : _sent) {
+      if (sent.sending) {
+        sent.sending->cancel();
+      }
     }
+    while (std::ranges::any_of(_sent, [](const SentRequest &sent) {
+      return sent.sending && !sent.sending->done();
+    })) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      _adapter->collect();
+    }
+
+    // Clear screen before exiting
+    std::print("\033[2J\033[H");
   }
 
-  void move_up() {
-    if (_selected > 0) {
-      _selected--;
+  // TODO(stanley): maybe merge to a common/shared function with `run`
+  int request_pick_at(ushort index) {
+    if (index > _menu.size()) {
+      std::println(stderr,
+                   "Error: out of range of requests available, you requested "
+                   "{} but there are {} requests.",
+                   index, _menu.size());
+      return 1;
+    }
+
+    _menu.jump_to(index - 1);
+    auto request = _menu.get_selected();
+    if (!_run_dependencies(*request)) {
+      return 1;
     }
+    _warm_up(std::span(&request, 1), 1);
+
+    if (const auto response = _execute(*request); !response.has_value()) {
+      std::println(stderr, "Transport error: {}", response.error().message);
+
+      return 1;
+    }
+
+    return 0;
   }
 
-  void move_down() {
-    if (_selected < static_cast<int>(_requests.size()) - 1) {
-      _selected++;
+  // Runs every loaded request, `parallel` at a time, printing the results in
+  // file order as soon as the preceding ones are done. Requests reading
+  // other responses wait for them: the file runs in waves, each one after
+  // the waves of the responses it reads.
+  int request_all(size_t parallel) {
+    std::vector<const HttpRequest *> requests;
+    requests.reserve(_menu.size());
+    for (const auto &request : _menu.requests()) {
+      requests.push_back(&request);
+    }
+
+    const auto waves = _waves();
+    if (!waves) {
+      return 1;
     }
+
+    _warm_up(requests, parallel);
+
+    std::vector<std::optional<RequestResult>> results(requests.size());
+    std::vector<std::filesystem::path> saved_to(requests.size());
+    size_t next_to_print = 0;
+    int exit_code = 0;
+
+    // Bodies are buffered to be printed in order, unless redirected to a file
+    auto make_sink = [&](size_t index) -> std::unique_ptr<ResponseSink> {
+      const auto &redirect = requests[index]->response_redirect;
+      if (!redirect) {
+        return nullptr;
+      }
+
+      auto sink = FileSink::open(redirect->resolve());
+      if (!sink) {
+        std::println(stderr, "{}", sink.error().message);
+        return nullptr;
+      }
+
+      saved_to[index] = (*sink)->path();
+      return std::move(*sink);
+    };
+
+    auto on_complete = [&](size_t index, RequestResult result) {
+      results[index] = std::move(result);
+
+      for (; next_to_print < results.size() &&
+             results[next_to_print].has_value();
+           next_to_print++) {
+        const HttpRequest &request = *requests[next_to_print];
+        auto &response = *results[next_to_print];
+
+        std::println("### [{}/{}] {} {}", next_to_print + 1,
+                     requests.size(), request.method,
+                     request.url.display());
+
+        if (response.has_value()) {
+          _print_head(*response);
+          if (saved_to[next_to_print].empty()) {
+            std::println("Body:");
+            std::println("{}", response->body.value_or("NOTHING"));
+          } else {
+            std::println("Body saved to {}",
+                         saved_to[next_to_print].string());
+          }
+          _print_transfer(*response);
+        } else {
+          std::println(stderr, "Transport error: {}",
+                       response.error().message);
+          exit_code = 1;
+        }
+
+        std::println();
+        // Printed results are not needed anymore
+        results[next_to_print].reset();
+      }
+    };
+
+    _run_waves(requests, *waves, parallel, make_sink, on_complete);
+
+    return exit_code;
   }
 
-  void toggle_details() { _show_details = !_show_details; }
+  // Headless run for CI: one JSON object per completed request on stdout,
+  // in completion order. Bodies are dropped unless redirected with `>>`.
+  // An empty `pick_index` selects the whole file.
+  int request_batch(std::optional<short> pick_index, size_t parallel) {
+    std::vector<const HttpRequest *> requests;
+    // File index of each entry of `requests`
+    std::vector<size_t> indices;
+    std::vector<size_t> waves;
+
+    if (pick_index.has_value()) {
+      if (static_cast<size_t>(*pick_index) > _menu.size()) {
+        std::println(stderr,
+                     "Error: out of range of requests available, you "
+                     "requested {} but there are {} requests.",
+                     *pick_index, _menu.size());
+        return 1;
+      }
+
+      const HttpRequest &request = _menu.requests()[*pick_index - 1];
+      if (!_run_dependencies(request)) {
+        return 1;
+      }
+      requests.push_back(&request);
+      indices.push_back(*pick_index - 1);
+      waves.push_back(0);
+    } else {
+      auto all_waves = _waves();
+      if (!all_waves) {
+        return 1;
+      }
+      waves = std::move(*all_waves);
 
-  std::shared_ptr<HttpRequest> get_selected() {
-    if (_selected >= 0 && _selected < static_cast<int>(_requests.size())) {
-      return _requests[_selected];
+      for (size_t i = 0; i < _menu.size(); i++) {
+        requests.push_back(&_menu.requests()[i]);
+        indices.push_back(i);
+      }
     }
-    return nullptr;
+
+    _warm_up(requests, parallel);
+
+    JsonLineWriter writer(stdout);
+    int exit_code = 0;
+
+    auto make_sink = [&](size_t index) -> std::unique_ptr<ResponseSink> {
+      const auto &redirect = requests[index]->response_redirect;
+      if (!redirect) {
+        return std::make_unique<DiscardSink>();
+      }
+
+      auto sink = FileSink::open(redirect->resolve());
+      if (!sink) {
+        std::println(stderr, "{}", sink.error().message);
+        return std::make_unique<DiscardSink>();
+      }
+      return std::move(*sink);
+    };
+
+    auto on_complete = [&](size_t index, RequestResult result) {
+      const HttpRequest &request = *requests[index];
+
+      writer.field("index", indices[index] + 1)
+          .field("name", request.name)
+          .field("method", request.method)
+          .field("url", request.url.display());
+
+      if (!result.has_value()) {
+        writer.null_field("status").field("error", result.error().message);
+        exit_code = 1;
+      } else {
+        const HttpTimings &timings = result->timings;
+        writer.field("status", result->status_code)
+            .field("http_version", http_version_name(result->http_version))
+            .field("connection_reused", result->connection_reused)
+            .field("cache", result->cache == CacheOutcome::stored ? "stored"
+                            : result->cache == CacheOutcome::revalidated
+                                ? "revalidated"
+                                : "none")
+            .begin_object("timings_ms")
+            .field("name_lookup", timings.name_lookup)
+            .field("connect", timings.connect)
+            .field("tls_handshake", timings.tls_handshake)
+            .field("pre_transfer", timings.pre_transfer)
+            .field("time_to_first_byte", timings.time_to_first_byte)
+            .field("total", timings.total)
+            .end_object()
+            .field("uploaded_bytes", timings.uploaded_bytes)
+            .field("downloaded_bytes", timings.downloaded_bytes)
+            .null_field("error");
+      }
+
+      if (!writer.end_record()) {
+        exit_code = 1;
+      }
+    };
+
+    _run_waves(requests, waves, parallel, make_sink, on_complete);
+
+    return exit_code;
   }
 
-  void reset() {
-    _selected = 0;
-    _show_details = false;
+  // Closed-loop load test: every selected request is sent `repeat` times,
+  // with `concurrency` requests kept in flight until the batch drains.
+  // An empty `pick_index` selects the whole file.
+  int request_load(std::optional<short> pick_index, size_t repeat,
+                   size_t concurrency) {
+    std::vector<const HttpRequest *> selected;
+
+    if (pick_index.has_value()) {
+      if (static_cast<size_t>(*pick_index) > _menu.size()) {
+        std::println(stderr,
+                     "Error: out of range of requests available, you "
+                     "requested {} but there are {} requests.",
+                     *pick_index, _menu.size());
+        return 1;
+      }
+      selected.push_back(&_menu.requests()[*pick_index - 1]);
+    } else {
+      for (const auto &request : _menu.requests()) {
+        selected.push_back(&request);
+      }
+    }
+
+    // Responses the requests read are fetched once, before the clock starts
+    for (const HttpRequest *request : selected) {
+      if (!_run_dependencies(*request)) {
+        return 1;
+      }
+    }
+
+    std::vector<const HttpRequest *> batch;
+    batch.reserve(selected.size() * repeat);
+    for (size_t i = 0; i < repeat; i++) {
+      batch.insert(batch.end(), selected.begin(), selected.end());
+    }
+
+    _warm_up(batch, concurrency);
+
+    LatencyHistogram latencies;
+    std::map<long, size_t> status_counts;
+    std::map<std::string, size_t> transport_errors;
+
+    const auto started_at = std::chrono::steady_clock::now();
+
+    // Only the numbers matter, bodies go straight to the bin
+    auto discard = [](size_t) -> std::unique_ptr<ResponseSink> {
+      return std::make_unique<DiscardSink>();
+    };
+
+    _adapter->do_requests(batch, concurrency, discard,
+                          [&](size_t, RequestResult result) {
+                            if (!result.has_value()) {
+                              transport_errors[result.error().message]++;
+                              return;
+                            }
+
+                            latencies.record(result->timings.total);
+                            status_counts[result->status_code]++;
+                          });
+
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - started_at;
+
+    size_t error_count = 0;
+    for (const auto &[message, count] : transport_errors) {
+      error_count += count;
+    }
+
+    std::println("Requests:    {} ({} x {}, concurrency {})", batch.size(),
+                 repeat, selected.size(), concurrency);
+    std::println("Duration:    {:.3f} s", elapsed.count());
+    std::println("Throughput:  {:.1f} req/s",
+                 elapsed.count() > 0
+                     ? static_cast<double>(batch.size()) / elapsed.count()
+                     : 0.0);
+
+    std::println("Status codes:");
+    for (const auto &[status, count] : status_counts) {
+      std::println("  {}: {}", status, count);
+    }
+
+    if (!transport_errors.empty()) {
+      std::println("Transport errors:");
+      for (const auto &[message, count] : transport_errors) {
+        std::println("  {}: {}", message, count);
+      }
+    }
+
+    std::println("Latency:");
+    for (const auto &[label, percentile] :
+         {std::pair{"p50", 50.0}, std::pair{"p90", 90.0},
+          std::pair{"p99", 99.0}, std::pair{"p99.9", 99.9}}) {
+      std::println("  {:<6} {:.3f} ms", label,
+                   latencies.value_at_percentile(percentile).count() / 1000.0);
+    }
+    std::println("  {:<6} {:.3f} ms", "max",
+                 latencies.max().count() / 1000.0);
+
+    return error_count > 0 ? 1 : 0;
   }
 
-  size_t size() const { return _requests.size(); }
+  // --watch without the menu: runs `run` again after every change to the
+  // watched files, until interrupted
+  [[noreturn]] void watch(const std::function<int()> &run) {
+    std::println(stderr, "Watching {} for changes, press Ctrl-C to stop.",
+                 _request_file);
+
+    while (true) {
+      // Runs end up on screen, or in the file stdout goes to, right away
+      std::fflush(stdout);
+
+      const auto reloaded = _reload(_watcher->wait(std::chrono::hours(1)));
+      if (!reloaded) {
+        std::println(stderr, "\n{}", reloaded.error().message);
+      } else if (!reloaded->empty()) {
+        std::println(stderr, "\n{}", *reloaded);
+        run();
+      }
+    }
+  }
 
 private:
-  std::vector<std::shared_ptr<HttpRequest>> _requests;
-  int _selected = 0;
-  bool _show_details = false;
-};
+  ParsedCollection _collection;
+  RequestMenu _menu;
+  std::unique_ptr<RequestAdapter> _adapter;
+  bool _warmup = false;
+  ResponseStore _responses;
+  std::unique_ptr<ResponseCache> _cache;
+  // First request of each `# @name`
+  std::unordered_map<std::string_view, size_t, StringHash, std::equal_to<>>
+      _named;
+
+  static constexpr size_t _no_wave = SIZE_MAX;
+
+  // --watch
+  static constexpr std::chrono::milliseconds _watch_interval{100};
+  std::unique_ptr<FileWatcher> _watcher;
+  std::string _request_file;
+  std::optional<std::string> _environment_name;
+  std::shared_ptr<const Environment> _environment;
+  // --watch-check
+  bool _check_reparse = false;
+
+  // --watch parses a copy of the file: a mapping changes under the parsed
+  // requests as soon as an editor saves in place
+  static std::optional<std::string> _read_file(const std::string &filename) {
+    auto reader = create_mmap_reader(filename);
+    if (!reader->is_open()) {
+      return std::nullopt;
+    }
+    return std::string(reader->get_data(), reader->get_size());
+  }
 
-template <typename R>
-concept ConvertibleToStringViewRange =
-    std::ranges::range<R> &&
-    std::convertible_to<std::ranges::range_reference_t<R>, std::string_view>;
+  // The request file, the environment files and the `< path` bodies
+  std::vector<std::filesystem::path> _watched_files() const {
+    const auto directory = std::filesystem::path(_request_file).parent_path();
+    std::vector<std::filesystem::path> files{_request_file};
 
-// HTTP Request Parser with variable support
-class HttpRequestParser {
-public:
-  static std::vector<std::shared_ptr<HttpRequest>>
-  parse_contents(ConvertibleToStringViewRange auto &&range) {
-    std::vector<std::shared_ptr<HttpRequest>> requests;
+    if (_environment_name) {
+      files.push_back(directory / Environment::public_file);
+      files.push_back(directory / Environment::private_file);
+    }
 
-    // Clear variables for a fresh parse
-    _variables.clear();
+    for (const auto &request : _collection.requests()) {
+      if (request.body_file &&
+          std::ranges::find(files, *request.body_file) == files.end()) {
+        files.push_back(*request.body_file);
+      }
+    }
 
-    std::shared_ptr<HttpRequest> current_request = nullptr;
-    bool in_headers = false;
-    bool in_body = false;
-    std::string name;
-    std::string body;
+    return files;
+  }
 
-    for (std::string_view line : range) {
-      if (line.starts_with("# @name")) {
-        constexpr auto nameSize = string_length("# @name");
-        name = std::string_view(line).substr(nameSize + 1);
-        continue;
+  // Takes in changes to the watched files, parsing the request file again
+  // when it or the environment changed. Returns what happened, empty when
+  // no watched file changed. On errors, the requests are left as they were.
+  std::expected<std::string, AgatetepeError>
+  _reload(const std::vector<std::filesystem::path> &changed) {
+    if (changed.empty()) {
+      return {};
+    }
+
+    const auto directory = std::filesystem::path(_request_file).parent_path();
+    bool reparse = false;
+    bool reload_environment = false;
+    for (const auto &file : changed) {
+      reparse = reparse || file == _request_file;
+      reload_environment = reload_environment ||
+                           (_environment_name &&
+                            (file == directory / Environment::public_file ||
+                             file == directory / Environment::private_file));
+    }
+
+    if (reload_environment) {
+      auto loaded = Environment::load(directory, *_environment_name);
+      if (!loaded) {
+        return std::unexpected(loaded.error());
       }
+      _environment = std::make_shared<const Environment>(std::move(*loaded));
+      reparse = true;
+    }
 
-      // Skip comments
-      if (line.starts_with("#") || line.starts_with("//")) {
-        continue;
+    if (!reparse) {
+      return std::format("{} changed", changed.front().string());
+    }
+
+    auto text = _read_file(_request_file);
+    if (!text) {
+      return std::unexpected(AgatetepeError{
+          .code = e_agatetepe_error::io_error,
+          .message = std::format("Error: Could not read {}", _request_file)});
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    _collection = HttpRequestParser(_environment)
+                      .reparse(std::move(*text), directory,
+                               std::move(_collection));
+    const std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    const size_t reused = _collection.reused();
+
+    std::optional<std::string> mismatch;
+    if (_check_reparse) {
+      mismatch = _compare_full_parse(directory);
+    }
+
+    _menu.set_requests(_collection.requests());
+    auto warnings = _index_requests();
+    if (mismatch) {
+      warnings.insert(warnings.begin(), std::move(*mismatch));
+    }
+    _watcher->watch(_watched_files());
+
+    // The menu owns the screen, warnings go with the status line
+    std::string status = std::format(
+        "Reloaded {}: {} of {} requests parsed again in {:.1f} ms",
+        _request_file, _collection.size() - reused, _collection.size(),
+        elapsed.count());
+    for (const auto &warning : warnings) {
+      status += std::format(". {}", warning);
+    }
+    return status;
+  }
+
+  // --watch-check: parses the whole text again and compares it with what
+  // the incremental parse made. On a difference the full parse takes over,
+  // and a warning names the first request that differed.
+  std::optional<std::string>
+  _compare_full_parse(const std::filesystem::path &directory) {
+    ParsedCollection full = HttpRequestParser(_environment)
+                                .reparse(std::string(_collection.text()),
+                                         directory);
+
+    const auto incremental = _collection.requests();
+    const auto expected = full.requests();
+    const auto differs = std::ranges::mismatch(incremental, expected).in1;
+    if (differs == incremental.end() &&
+        incremental.size() == expected.size()) {
+      return std::nullopt;
+    }
+
+    _collection = std::move(full);
+    return std::format("Warning: request {} differs from a full parse, "
+                       "which is used instead",
+                       differs - incremental.begin() + 1);
+  }
+
+  // Tracks the response references of the loaded requests and indexes the
+  // requests they name. Returns warnings about references to no request and
+  // about body text a `< path` line overrides, for the caller to show.
+  std::vector<std::string> _index_requests() {
+    std::vector<std::string> warnings;
+    _responses = ResponseStore();
+    _named.clear();
+
+    const auto requests = _menu.requests();
+    for (size_t i = 0; i < requests.size(); i++) {
+      if (!requests[i].name.empty()) {
+        _named.try_emplace(requests[i].name, i);
       }
+    }
 
-      // Parse variable declarations
-      if (line.find("@") == 0) {
-        _parse_variable(line);
-        continue;
+    for (size_t i = 0; i < requests.size(); i++) {
+      const HttpRequest &request = requests[i];
+      if (request.body_file && !request.body.empty()) {
+        warnings.push_back(std::format(
+            "Warning: request {} sends {} as its body, the text after the "
+            "`<` line is ignored.",
+            i + 1, request.body_file->string()));
       }
 
-      // Skip empty lines
-      if (line.empty()) {
-        if (current_request && in_headers) {
-          in_headers = false;
-          in_body = true;
-          body = "";
-          name = "";
+      for (const auto &reference : request.response_references()) {
+        if (!_responses.tracks(reference.request) &&
+            !_named.contains(reference.request)) {
+          warnings.push_back(std::format(
+              "Warning: no request is named {}, its response references "
+              "render empty.",
+              reference.request));
         }
-        continue;
+        _responses.track(reference);
       }
+    }
 
-      // Check if it's a new request (starts with HTTP method)
-      if (line.find("GET ") == 0 || line.find("POST ") == 0 ||
-          line.find("PUT ") == 0 || line.find("PATCH ") == 0 ||
-          line.find("DELETE ") == 0) {
+    _adapter->set_response_store(&_responses);
+    return warnings;
+  }
 
-        // Save previous request if exists
-        if (current_request) {
-          if (in_body && !body.empty()) {
-            current_request->set_body(body);
-          }
-          requests.push_back(current_request);
-        }
+  // Indices of the requests `request` reads responses from
+  std::vector<size_t> _dependencies_of(const HttpRequest &request) const {
+    std::vector<size_t> dependencies;
+    for (const auto &reference : request.response_references()) {
+      auto it = _named.find(reference.request);
+      if (it != _named.end() &&
+          std::ranges::find(dependencies, it->second) == dependencies.end()) {
+        dependencies.push_back(it->second);
+      }
+    }
+    return dependencies;
+  }
 
-        // Parse method and URL, substituting variables
-        std::string processed_line = _substitue_variables(line);
-        size_t space_pos = processed_line.find(' ');
-        std::string method = processed_line.substr(0, space_pos);
-        std::string url = processed_line.substr(space_pos + 1);
-
-        // Create new request
-        current_request = std::make_shared<HttpRequest>(method, url, name);
-        in_headers = true;
-        in_body = false;
-        body = "";
-        name = "";
-      }
-      // Parse headers
-      else if (in_headers && current_request) {
-        size_t colon_pos = line.find(':');
-        if (colon_pos != std::string::npos) {
-          std::string_view key = line.substr(0, colon_pos);
-          std::string_view value = line.substr(colon_pos + 1);
-
-          std::string_view trimmed_key = _trim_whitespace(key);
-          std::string_view trimmed_value = _trim_whitespace(value);
-          // Substitute variables in header values
-          std::string transformed_value = _substitue_variables(trimmed_value);
-
-          current_request->add_header(std::string(trimmed_key),
-                                      transformed_value);
-        }
+  // --all wave of every loaded request, or nothing after reporting a
+  // reference cycle
+  std::optional<std::vector<size_t>> _waves() const {
+    std::vector<size_t> waves(_menu.size(), _no_wave);
+    std::vector<char> visiting(_menu.size(), false);
+
+    for (size_t i = 0; i < waves.size(); i++) {
+      if (!_assign_wave(i, waves, visiting)) {
+        std::println(stderr,
+                     "Error: request {} reads its own response through its "
+                     "response references.",
+                     i + 1);
+        return std::nullopt;
       }
-      // Parse body
-      else if (in_body && current_request) {
-        if (!body.empty()) {
-          body += "\n";
+    }
+
+    return waves;
+  }
+
+  // Runs `requests` one wave after the other, `parallel` at a time within a
+  // wave. Indices given to the callbacks are positions in `requests`.
+  void _run_waves(std::span<const HttpRequest *const> requests,
+                  std::span<const size_t> waves, const size_t parallel,
+                  const SinkFactory &make_sink,
+                  const CompletionHandler &on_complete) {
+    const size_t last_wave = std::ranges::max(waves);
+    for (size_t wave = 0; wave <= last_wave; wave++) {
+      std::vector<const HttpRequest *> batch;
+      std::vector<size_t> indices;
+      for (size_t i = 0; i < requests.size(); i++) {
+        if (waves[i] == wave) {
+          batch.push_back(requests[i]);
+          indices.push_back(i);
         }
-        body += _substitue_variables(line);
       }
+
+      _adapter->do_requests(
+          batch, parallel,
+          [&](size_t index) { return make_sink(indices[index]); },
+          [&](size_t index, RequestResult result) {
+            on_complete(indices[index], std::move(result));
+          });
     }
+  }
 
-    // Add the last request if exists
-    if (current_request) {
-      if (in_body && !body.empty()) {
-        // Substitute variables in body
-        body = _substitue_variables(body);
-        current_request->set_body(body);
+  // --all wave of request `index`: one past the waves of the requests it
+  // reads responses from. False on a reference cycle.
+  bool _assign_wave(const size_t index, std::vector<size_t> &waves,
+                    std::vector<char> &visiting) const {
+    if (waves[index] != _no_wave) {
+      return true;
+    }
+    if (visiting[index]) {
+      return false;
+    }
+
+    visiting[index] = true;
+    size_t wave = 0;
+    for (const size_t dependency : _dependencies_of(_menu.requests()[index])) {
+      if (!_assign_wave(dependency, waves, visiting)) {
+        return false;
       }
-      requests.push_back(current_request);
+      wave = std::max(wave, waves[dependency] + 1);
     }
+    visiting[index] = false;
 
-    return requests;
+    waves[index] = wave;
+    return true;
   }
 
-  static std::vector<std::shared_ptr<HttpRequest>>
-  parse_file(const std::string_view filename) {
-    auto reader = create_mmap_reader((std::string(filename)));
+  // A request sent from the menu. The dependencies that hadn't answered yet
+  // are sent first, one at a time, then the request itself.
+  struct SentRequest {
+    std::string label;
+    // Indices in the collection, the request itself last
+    std::vector<size_t> steps;
+    size_t step = 0;
+    // Name of the dependency being sent, empty once it's the request itself
+    std::string dependency;
+    // Dependencies other sent requests are sending or have still to send,
+    // by name and index, waited for rather than sent twice. Nothing is sent
+    // before they answered.
+    std::vector<std::pair<std::string, size_t>> awaiting;
+    std::shared_ptr<BackgroundRequest> sending;
+    // Where `>>` saves the body, else where it is spooled to
+    std::optional<std::filesystem::path> saved_to;
+    std::shared_ptr<SpoolFile> spool;
+    // Why it stopped short of sending the request itself
+    std::optional<std::string> failure;
+
+    bool finished() const {
+      return failure ||
+             (step + 1 == steps.size() && sending && sending->done());
+    }
+  };
+
+  // Sent requests are picked by a single digit
+  static constexpr size_t _max_sent = 9;
+  std::vector<SentRequest> _sent;
+
+  // Sends request `index` without waiting for it, listed under the menu
+  void _send(const size_t index) {
+    if (_sent.size() >= _max_sent &&
+        std::ranges::none_of(_sent, &SentRequest::finished)) {
+      _menu.set_status(std::format("{} requests are still running, wait for "
+                                   "one or cancel it with c.",
+                                   _max_sent));
+      return;
+    }
 
-    if (!reader->is_open()) {
-      std::println(stderr, "Error: Could not open file {}", filename);
-      return std::vector<std::shared_ptr<HttpRequest>>{};
+    const HttpRequest &request = _menu.requests()[index];
+    SentRequest sent{
+        .label = request.name.empty()
+                     ? std::format("{} {}", request.method,
+                                   request.url.display())
+                     : std::string(request.name),
+        .steps = {},
+        .step = 0,
+        .dependency = {},
+        .awaiting = {},
+        .sending = nullptr,
+        .saved_to = std::nullopt,
+        .spool = nullptr,
+        .failure = std::nullopt};
+
+    std::vector<char> visiting(_menu.size(), false);
+    if (!_plan_send(index, sent, visiting)) {
+      sent.failure = "Error: the request reads its own response through its "
+                     "response references.";
     }
 
-    return parse_contents(*reader);
-  }
+    // The oldest finished request makes room
+    if (_sent.size() >= _max_sent) {
+      if (auto oldest = std::ranges::find_if(
+              _sent, [](const SentRequest &old) { return old.finished(); });
+          oldest != _sent.end()) {
+        _sent.erase(oldest);
+      }
+    }
 
-  static std::vector<std::shared_ptr<HttpRequest>>
-  parse_string(const std::string_view string_content) {
-    return parse_contents(
-        string_content | std::views::split('\n') |
-        std::views::transform([](auto r) { return std::string_view(r); }));
+    _sent.push_back(std::move(sent));
+    _advance(_sent.back());
   }
 
-private:
-  static std::map<std::string, std::string> _variables;
+  // Appends the requests to send for request `index` to the steps of
+  // `sent`: the dependencies without an answer, their own dependencies
+  // first, then `index`. Dependencies another sent request is yet to
+  // answer are awaited instead. False on a reference cycle.
+  bool _plan_send(const size_t index, SentRequest &sent,
+                  std::vector<char> &visiting) const {
+    if (visiting[index]) {
+      return false;
+    }
 
-  static std::string_view _trim_whitespace(const std::string_view string) {
-    size_t start = string.find_first_not_of(" \t");
-    if (start == std::string_view::npos) {
-      return std::string_view(); // Empty string
+    visiting[index] = true;
+    for (const size_t dependency : _dependencies_of(_menu.requests()[index])) {
+      const std::string_view name = _menu.requests()[dependency].name;
+      if (_responses.received(name) ||
+          std::ranges::find(sent.steps, dependency) != sent.steps.end()) {
+        continue;
+      }
+
+      if (_pending(dependency)) {
+        if (std::ranges::find(sent.awaiting, dependency,
+                              &std::pair<std::string, size_t>::second) ==
+            sent.awaiting.end()) {
+          sent.awaiting.emplace_back(name, dependency);
+        }
+      } else if (!_plan_send(dependency, sent, visiting)) {
+        return false;
+      }
     }
+    visiting[index] = false;
 
-    size_t end = string.find_last_not_of(" \t");
-    return string.substr(start, end - start + 1);
+    sent.steps.push_back(index);
+    return true;
+  }
+
+  // Whether a sent request is yet to answer request `index`: sending it, or
+  // to send it once the steps before it answered
+  bool _pending(const size_t index) const {
+    return std::ranges::any_of(_sent, [&](const SentRequest &sent) {
+      if (sent.failure) {
+        return false;
+      }
+      for (size_t step = sent.step; step < sent.steps.size(); step++) {
+        if (sent.steps[step] == index) {
+          return step > sent.step || !sent.sending || !sent.sending->done();
+        }
+      }
+      return false;
+    });
   }
 
-  // Parse a variable declaration line
-  static void _parse_variable(const std::string_view line) {
-    // Remove leading @
-    std::string_view var_line = line.substr(1);
+  // Starts the next step of `sent` once the one before answered. Steps are
+  // rendered as they start, after the responses they read were stored.
+  void _advance(SentRequest &sent) {
+    while (!sent.failure) {
+      if (!sent.sending) {
+        for (const auto &[name, index] : sent.awaiting) {
+          if (_responses.received(name)) {
+            continue;
+          }
+          if (_pending(index)) {
+            return;
+          }
+          sent.failure = _unanswered(name, index);
+          return;
+        }
+      } else {
+        if (!sent.sending->done() || sent.step + 1 == sent.steps.size()) {
+          return;
+        }
+        if (const auto &result = sent.sending->result(); !result) {
+          sent.failure = result.error().code == e_agatetepe_error::cancelled
+                             ? "Cancelled."
+                             : std::format("Transport error in {}: {}",
+                                           sent.dependency,
+                                           result.error().message);
+          return;
+        }
+        sent.step++;
+      }
+
+      const HttpRequest &request = _menu.requests()[sent.steps[sent.step]];
+      const bool last = sent.step + 1 == sent.steps.size();
+      sent.dependency = last ? "" : std::string(request.name);
+
+      std::unique_ptr<ResponseSink> sink;
+      if (last && request.response_redirect) {
+        auto file = FileSink::open(request.response_redirect->resolve());
+        if (!file) {
+          sent.failure = file.error().message;
+          return;
+        }
+        sent.saved_to = (*file)->path();
+        sink = std::move(*file);
+      } else if (last) {
+        // Buffered in memory when no spool file can be made
+        if (auto spool = std::shared_ptr(create_spool_file());
+            spool->is_open()) {
+          sent.spool = spool;
+          sink = std::make_unique<SpoolSink>(std::move(spool));
+        }
+      }
+
+      sent.sending = _adapter->start_request(request, std::move(sink));
+    }
+  }
 
-    // Find the equal sign
-    size_t equal_pos = var_line.find('=');
-    if (equal_pos == std::string::npos) {
-      return; // Invalid variable declaration
+  // Why request `index`, awaited by a sent request, will get no answer
+  std::string _unanswered(const std::string_view name,
+                          const size_t index) const {
+    for (const auto &other : _sent) {
+      if (other.sending && other.sending->done() &&
+          other.steps[other.step] == index) {
+        if (const auto &result = other.sending->result(); !result) {
+          return result.error().code == e_agatetepe_error::cancelled
+                     ? std::format("{} was cancelled.", name)
+                     : std::format("Transport error in {}: {}", name,
+                                   result.error().message);
+        }
+      }
     }
+    return std::format("{} was not sent.", name);
+  }
 
-    // Extract variable name and value
-    std::string_view var_name = _trim_whitespace(var_line.substr(0, equal_pos));
-    std::string_view var_value =
-        _trim_whitespace(var_line.substr(equal_pos + 1));
+  // Collects the transfers the adapter finished, moves the sent requests
+  // along and lists them under the menu. Whether that changed the list.
+  bool _update_sent() {
+    _adapter->collect();
 
-    // Handle quoted strings
-    if (var_value.front() == '"' && var_value.back() == '"') {
-      var_value = var_value.substr(1, var_value.length() - 2);
+    std::vector<std::string> lines;
+    if (!_sent.empty()) {
+      lines.emplace_back(
+          "Sent requests, 1-9 shows a response, c cancels the latest:");
     }
-
-    // Store the variable
-    _variables[std::string(var_name)] = std::string(var_value);
+    for (size_t i = 0; i < _sent.size(); i++) {
+      _advance(_sent[i]);
+      lines.push_back(std::format("[{}] {}  {}", i + 1, _sent[i].label,
+                                  _describe(_sent[i])));
+    }
+    return _menu.set_activity(std::move(lines));
   }
 
-  // Substitute variables in a string without using regex
-  static std::string _substitue_variables(const std::string_view input) {
-    std::string result = std::string(input);
-    size_t pos = 0;
-
-    while (pos < result.length()) {
-      // Look for the start of a variable
-      size_t start = result.find("{{", pos);
-      if (start == std::string::npos) {
-        break; // No more variables
-      }
+  // Progress while running: bytes, rate and time so far
+  static std::string _describe(const SentRequest &sent) {
+    if (sent.failure) {
+      return *sent.failure;
+    }
 
-      // Look for the end of the variable
-      size_t end = result.find("}}", start);
-      if (end == std::string::npos) {
-        break; // Malformed variable, stop processing
+    if (!sent.sending) {
+      std::string line = "waiting for";
+      for (const auto &[name, index] : sent.awaiting) {
+        line += std::format(" {}", name);
       }
+      return line;
+    }
 
-      // Extract variable name
-      std::string var_name = result.substr(start + 2, end - start - 2);
+    const double seconds =
+        std::chrono::duration<double>(sent.sending->elapsed()).count();
 
-      // Find the replacement value
-      std::string replacement =
-          var_name.starts_with("$") ? DynamicVariableResolver::resolve(var_name)
-          : _variables.count(var_name) ? _variables[var_name]
-                                       : "";
+    if (!sent.finished()) {
+      const auto progress = sent.sending->progress();
+      std::string line;
+      if (!sent.dependency.empty()) {
+        line = std::format("sending {} first: ", sent.dependency);
+      }
+      if (progress.upload_size > 0 &&
+          progress.uploaded < progress.upload_size) {
+        line += std::format("{} of {} up, ", _format_bytes(progress.uploaded),
+                            _format_bytes(progress.upload_size));
+      }
+      line += _format_bytes(progress.downloaded);
+      if (progress.download_size > 0) {
+        line += std::format(" of {}", _format_bytes(progress.download_size));
+      }
+      const auto rate = seconds > 0 ? static_cast<uint64_t>(
+                                          progress.downloaded / seconds)
+                                    : 0;
+      return line + std::format(" down, {}/s, {:.1f} s", _format_bytes(rate),
+                                seconds);
+    }
 
-      // Replace the variable with its value
-      result.replace(start, end - start + 2, replacement);
+    const auto &result = sent.sending->result();
+    if (!result) {
+      return result.error().code == e_agatetepe_error::cancelled
+                 ? "Cancelled."
+                 : std::format("Transport error: {}", result.error().message);
+    }
+    return std::format("{}, {} in {:.2f} s", result->status_code,
+                       _format_bytes(result->timings.downloaded_bytes),
+                       seconds);
+  }
 
-      // Update position to continue after the replacement
-      pos = start + replacement.length();
+  // The newest request still running
+  void _cancel_latest() {
+    for (auto it = _sent.rbegin(); it != _sent.rend(); ++it) {
+      if (it->finished()) {
+        continue;
+      }
+      if (!it->sending) {
+        it->failure = "Cancelled.";
+        return;
+      }
+      if (!it->sending->cancelled()) {
+        it->sending->cancel();
+        return;
+      }
     }
+  }
 
-    return result;
+  // A reload renumbers the requests, those still sending or waiting for
+  // dependencies stop
+  void _stop_dependencies() {
+    for (auto &sent : _sent) {
+      if (!sent.finished() &&
+          (!sent.sending || sent.step + 1 < sent.steps.size())) {
+        if (sent.sending) {
+          sent.sending->cancel();
+        }
+        sent.failure = "Stopped, the requests were reloaded.";
+      }
+    }
   }
-};
 
-// Initialize the static member
-std::map<std::string, std::string> HttpRequestParser::_variables;
+  // How often the pager looks at the other requests and the terminal size
+  // while no key is pressed
+  static constexpr std::chrono::milliseconds _pager_poll_interval{100};
+
+  // Pages through the response of a finished request, its body read back
+  // from the spool or the `>>` file. Failures are printed instead.
+  void _show_sent(const SentRequest &sent, TerminalRenderer &screen,
+                  const TerminalInput &input) {
+    const RequestResult *result =
+        sent.failure ? nullptr : &sent.sending->result();
+    if (!result || !*result) {
+      screen.release();
+      std::println("{}\n", sent.label);
+      std::println(stderr, "{}",
+                   result ? std::format("Transport error: {}",
+                                        result->error().message)
+                          : *sent.failure);
+      std::print("Press any key to continue...");
+      input.get_key();
+      return;
+    }
 
-struct LoadRequestOptions {
-  bool should_eval = false;
-  bool should_feed_from_stdin = false;
-  bool show_help = false;
-  std::optional<short> pick_index;
-  std::string eval_string;
-  std::string request_file;
-};
+    const HttpResponse &response = **result;
+    std::string head;
+    _format_head(head, response);
+    _format_transfer(head, response);
+
+    std::unique_ptr<MmapReader> saved;
+    std::string_view body;
+    if (sent.saved_to) {
+      head += std::format("Body saved to {}:\n", sent.saved_to->string());
+      // The file may have been changed or removed since
+      saved = create_mmap_reader(sent.saved_to->string());
+      if (saved->is_open()) {
+        body = std::string_view(saved->get_data(), saved->get_size());
+      }
+    } else {
+      head += "Body:\n";
+      body = sent.spool       ? sent.spool->map()
+             : response.body ? std::string_view(*response.body)
+                             : std::string_view();
+    }
 
-// Main application
-class HttpRequestApp {
-public:
-  HttpRequestApp() : _adapter(std::make_unique<CurlAdapter>()) {}
+    std::vector<std::string> head_lines;
+    for (const auto line : std::views::split(head, '\n')) {
+      head_lines.emplace_back(line.begin(), line.end());
+    }
+    head_lines.pop_back();
+
+    ResponsePager pager(std::format("{}  {}, {}", sent.label,
+                                    response.status_code,
+                                    _format_bytes(body.size())),
+                        std::move(head_lines), body);
+    do {
+      pager.display(screen);
+      // Other requests move along meanwhile, and resizes are followed
+      while (!input.wait_for_key(_pager_poll_interval)) {
+        _update_sent();
+        if (screen.resized()) {
+          pager.display(screen);
+        }
+      }
+    } while (pager.handle_key(input.get_key()));
+  }
 
-  bool load_requests(const LoadRequestOptions &options) {
+  // Sends the requests `request` reads responses from, unless they already
+  // answered, dependencies first. Their responses go to the store, only a
+  // summary line is printed.
+  bool _run_dependencies(const HttpRequest &request) {
+    std::vector<char> visiting(_menu.size(), false);
+    visiting[&request - _menu.requests().data()] = true;
+    return _run_dependencies(request, visiting);
+  }
 
-    auto requests =
-        options.should_feed_from_stdin
-            ? HttpRequestParser::parse_string(_collect_stream_lines(std::cin))
-        : options.should_eval
-            ? HttpRequestParser::parse_string(options.eval_string)
-            : HttpRequestParser::parse_file(options.request_file);
+  bool _run_dependencies(const HttpRequest &request,
+                         std::vector<char> &visiting) {
+    for (const size_t index : _dependencies_of(request)) {
+      const HttpRequest &dependency = _menu.requests()[index];
+      if (_responses.received(dependency.name)) {
+        continue;
+      }
+      if (visiting[index]) {
+        std::println(stderr,
+                     "Error: request {} reads its own response through its "
+                     "response references.",
+                     index + 1);
+        return false;
+      }
 
-    if (requests.empty()) {
-      std::println(stderr, "No valid requests found.");
-      return false;
-    }
+      visiting[index] = true;
+      if (!_run_dependencies(dependency, visiting)) {
+        return false;
+      }
 
-    for (const auto &request : requests) {
-      _menu.add_request(request);
+      const auto response = _adapter->do_request(dependency);
+      if (!response.has_value()) {
+        std::println(stderr, "Transport error in {}: {}", dependency.name,
+                     response.error().message);
+        return false;
+      }
+      std::println(stderr, "{}: {} {} -> {}", dependency.name,
+                   dependency.method, dependency.url.display(),
+                   response->status_code);
+      visiting[index] = false;
     }
 
     return true;
   }
 
-  void run() {
-    if (_menu.size() == 0) {
-      std::println("No requests to display. Exiting.");
+  // --warmup: opens the connections a run will need before it starts, so
+  // its timings leave out DNS, TCP and TLS setup
+  void _warm_up(std::span<const HttpRequest *const> requests,
+                size_t connections) {
+    if (!_warmup) {
       return;
     }
 
-    auto input = create_terminal_input();
+    const auto started_at = std::chrono::steady_clock::now();
+    const size_t opened = _adapter->warm_up(requests, connections);
+    const std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - started_at;
 
-    while (true) {
-      _menu.display();
+    std::println(stderr, "Warm-up: {} connection(s) opened in {:.3f} ms",
+                 opened, elapsed.count());
+  }
 
-      int key = input->get_key();
+  // Prints the response head as soon as it is known, then lets the body
+  // through as it arrives.
+  class ConsoleSink : public StdoutSink {
+  public:
+    void on_head(const HttpResponse &head) override {
+      _print_head(head);
+      std::println("Body:");
+    }
+  };
+
+  // Runs a single request, streaming the body to the terminal, or into a
+  // file when the request asks for it with `>>`/`>>!`.
+  RequestResult _execute(const HttpRequest &request) {
+    if (request.response_redirect) {
+      auto sink = FileSink::open(request.response_redirect->resolve());
+      if (!sink) {
+        return std::unexpected(sink.error());
+      }
 
-      // Handle special keys
-      if (key == 1) { // Up arrow
-        _menu.move_up();
-      } else if (key == 2) { // Down arrow
-        _menu.move_down();
-      } else if (key == 'q' || key == 'Q') {
-        break;
-      } else if (key == 'd' || key == 'D') {
-        _menu.toggle_details();
-      } else if (key == '\n') { // Enter key
-        auto request = _menu.get_selected();
-        if (request) {
-          std::println("\nExecuting request...");
-          std::println("Method: {}", request->method);
-          std::println("URL: {}", request->url);
-
-          if (!request->headers.empty()) {
-            std::println("Headers:");
-            for (const auto &header : request->headers) {
-              std::println("  {}: {}", header.first, header.second);
-            }
-          }
+      auto response = _adapter->stream_request(request, **sink);
+      if (response.has_value()) {
+        _print_head(*response);
+        std::println("Body saved to {}", (*sink)->path().string());
+        _print_transfer(*response);
+      }
 
-          if (!request->body.empty()) {
-            std::println("Body:\n{}", request->body);
-          }
+      return response;
+    }
 
-          std::println("\nResponse:");
+    ConsoleSink sink;
+    auto response = _adapter->stream_request(request, sink);
+    if (response.has_value()) {
+      std::println();
+      _print_transfer(*response);
+    }
 
-          if (const auto response = _adapter->do_request(*request);
-              response.has_value()) {
-            std::println("Headers:");
+    return response;
+  }
 
-            for (const auto &header : response->headers) {
-              std::println("  {}: {}", header.first, header.second);
-            }
+  static void _print_head(const HttpResponse &response) {
+    std::string text;
+    _format_head(text, response);
+    std::print("{}", text);
+  }
 
-            std::println("Status: {}", response->status_code);
-            std::println("Body:");
-            std::println("{}\n", response->body.value_or("NOTHING"));
-          } else {
-            std::println(stderr, "Transport error: {}",
-                         response.error().message);
-          }
+  static void _print_transfer(const HttpResponse &response) {
+    std::string text;
+    _format_transfer(text, response);
+    std::print("{}", text);
+  }
 
-          std::print("Press any key to continue...");
-          input->get_key();
-        }
-      }
+  // The printed reports are also the pager's head lines, so they are built
+  // as text first
+  static void _format_head(std::string &out, const HttpResponse &response) {
+    auto it = std::back_inserter(out);
+    std::format_to(it, "Headers:\n");
+
+    for (const auto &[name, value] : response.headers.fields()) {
+      std::format_to(it, "  {}: {}\n", name, value);
     }
 
-    // Clear screen before exiting
-    std::print("\033[2J\033[H");
+    std::format_to(it, "Status: {}\n", response.status_code);
   }
 
-  // TODO(stanley): maybe merge to a common/shared function with `run`
-  int request_pick_at(ushort index) {
-    if (index > _menu.size()) {
-      std::println(stderr,
-                   "Error: out of range of requests available, you requested "
-                   "{} but there are {} requests.",
-                   index, _menu.size());
-      return 1;
+  static void _format_transfer(std::string &out,
+                               const HttpResponse &response) {
+    auto it = std::back_inserter(out);
+    std::format_to(it, "Connection: {} ({})\n",
+                   response.connection_reused ? "reused" : "new",
+                   http_version_name(response.http_version));
+    if (response.cache == CacheOutcome::stored) {
+      std::format_to(it, "Cache: stored\n");
+    } else if (response.cache == CacheOutcome::revalidated) {
+      std::format_to(it, "Cache: revalidated, body served from the cache\n");
     }
+    _format_timings(out, response.timings);
+  }
 
-    _menu.jump_to(index - 1);
-    auto request = _menu.get_selected();
-
-    if (const auto response = _adapter->do_request(*request);
-        response.has_value()) {
-      std::println("Headers:");
+  // Splits curl's cumulative milestones into phases. Milestones that did not
+  // happen (no TLS, reused connection) are zero and get folded into the
+  // following phase.
+  static void _format_timings(std::string &out, const HttpTimings &timings) {
+    using std::chrono::microseconds;
+
+    auto phase = [](microseconds milestone, microseconds previous) {
+      return milestone > previous ? milestone - previous : microseconds(0);
+    };
+
+    const microseconds connected = std::max(
+        {timings.name_lookup, timings.connect, timings.tls_handshake});
+
+    const std::array<std::tuple<std::string_view, microseconds, microseconds>,
+                     6>
+        rows{{
+            {"DNS lookup", timings.name_lookup, timings.name_lookup},
+            {"TCP connect", phase(timings.connect, timings.name_lookup),
+             timings.connect},
+            {"TLS handshake", phase(timings.tls_handshake, timings.connect),
+             timings.tls_handshake},
+            {"Pre-transfer", phase(timings.pre_transfer, connected),
+             timings.pre_transfer},
+            {"Server wait", phase(timings.time_to_first_byte,
+                                  timings.pre_transfer),
+             timings.time_to_first_byte},
+            {"Download", phase(timings.total, timings.time_to_first_byte),
+             timings.total},
+        }};
+
+    auto it = std::back_inserter(out);
+    std::format_to(it, "Timings:          phase     since start\n");
+    for (const auto &[label, duration, since_start] : rows) {
+      std::format_to(it, "  {:<13} {:>9.3f} ms {:>9.3f} ms\n", label,
+                     duration.count() / 1000.0, since_start.count() / 1000.0);
+    }
 
-      for (const auto &header : response->headers) {
-        std::println("  {}: {}", header.first, header.second);
-      }
+    std::format_to(it, "Transferred: {} up ({}/s), {} down ({}/s)\n",
+                   _format_bytes(timings.uploaded_bytes),
+                   _format_bytes(timings.upload_speed),
+                   _format_bytes(timings.downloaded_bytes),
+                   _format_bytes(timings.download_speed));
+  }
 
-      std::println("Status: {}", response->status_code);
-      std::println("Body:");
-      std::println("{}", response->body.value_or("NOTHING"));
-    } else {
-      std::println(stderr, "Transport error: {}", response.error().message);
+  static std::string _format_bytes(uint64_t bytes) {
+    static constexpr std::array<std::string_view, 5> units{"B", "KiB", "MiB",
+                                                           "GiB", "TiB"};
+    auto value = static_cast<double>(bytes);
+    size_t unit = 0;
 
-      return 1;
+    while (value >= 1024.0 && unit + 1 < units.size()) {
+      value /= 1024.0;
+      unit++;
     }
 
-    return 0;
+    return unit == 0 ? std::format("{} B", bytes)
+                     : std::format("{:.1f} {}", value, units[unit]);
   }
 
-private:
-  RequestMenu _menu;
-  std::unique_ptr<RequestAdapter> _adapter;
-
   static std::string _collect_stream_lines(std::istream &in) {
     std::string ret;
     ret.reserve(64 * 1024); // reserve 64 KB to reduce early reallocations
@@ -930,7 +7265,55 @@ void print_usage(const std::string_view program_name) {
       "  --stdin              Reads the HTTP request from standard input.\n");
   std::println("General Options:");
   std::println("  -p, --pick-index     Picks a specific request at index if "
-               "possible.\n");
+               "possible.");
+  std::println("  -a, --all            Runs every request, printing the "
+               "results in file order.");
+  std::println("  --batch              Runs the picked request, or every "
+               "request, without the menu");
+  std::println("                       and prints one JSON object per "
+               "completed request (NDJSON).");
+  std::println("  -j, --parallel <n>   With --all or --batch, keeps up to n "
+               "requests in flight (default 1).");
+  std::println("  -n, --repeat <n>     Load test: sends the picked request "
+               "(or every request) n times");
+  std::println("                       and reports throughput and latency "
+               "percentiles.");
+  std::println("  -c, --concurrency <n> With --repeat, keeps up to n requests "
+               "in flight (default 1).");
+  std::println("  --env <name>         Uses the variables of environment "
+               "<name>, from http-client.env.json");
+  std::println("                       and http-client.private.env.json next "
+               "to the request file.");
+  std::println("  --seed <n>           Seeds the random dynamic variables, "
+               "like {{{{$uuid}}}},");
+  std::println("                       so runs can be reproduced.");
+  std::println("  --cache              Keeps GET responses carrying an ETag "
+               "or Last-Modified on disk,");
+  std::println("                       revalidates them and serves the body "
+               "from disk on 304.");
+  std::println("  --cache-dir <dir>    Same as --cache, in dir instead of "
+               "$XDG_CACHE_HOME/agatetepe/responses.");
+  std::println("  --warmup             Opens the connections a run needs "
+               "before timing it,");
+  std::println("                       one per request in flight and "
+               "origin.");
+  std::println("  --resolve <host:port:addr>  Connects to addr for host:port "
+               "instead of");
+  std::println("                       resolving it, can be repeated.");
+  std::println("  --parse-threads <n>  Parses the file on n threads, split on "
+               "### separators.");
+  std::println("                       Variables then apply file-wide "
+               "(default 1).");
+  std::println("  --parse-cache        Saves the parsed file under "
+               "$XDG_CACHE_HOME/agatetepe/parse");
+  std::println("                       and loads it back while the file is "
+               "unchanged.");
+  std::println("  --watch              Parses the file again on every save, "
+               "only the edited requests,");
+  std::println("                       then refreshes the menu or runs "
+               "again.");
+  std::println("  --watch-check        Same as --watch, and checks every "
+               "reload against a full parse.\n");
   std::println(
       "  -h, --help           Displays this help message and exits.\n");
   std::println("Examples:");
@@ -943,6 +7326,32 @@ void print_usage(const std::string_view program_name) {
   std::println(
       "  # Picks the request at index 1 (first request, top-down wise)");
   std::println("  {} --pick-index 1 requests.http\n", program_name);
+  std::println("  # Runs the whole file, 16 requests at a time");
+  std::println("  {} --all --parallel 16 requests.http\n", program_name);
+  std::println("  # Results of the whole file as JSON lines, for CI");
+  std::println("  {} --batch -j 8 requests.http > results.ndjson\n",
+               program_name);
+  std::println("  # Sends request 2 ten thousand times, 32 at a time");
+  std::println("  {} -p 2 --repeat 10000 --concurrency 32 requests.http\n",
+               program_name);
+  std::println("  # Runs request 3 again whenever the file is saved");
+  std::println("  {} -p 3 --watch requests.http\n", program_name);
+  std::println("  # Same, on warm connections to a staging box");
+  std::println("  {} -p 2 -n 10000 -c 32 --warmup --resolve "
+               "api.example.com:443:10.0.0.5 requests.http\n",
+               program_name);
+}
+
+std::optional<size_t> parse_positive_number(const std::string_view text) {
+  size_t number = 0;
+  const auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), number);
+
+  if (error != std::errc() || end != text.data() + text.size() || number == 0) {
+    return std::nullopt;
+  }
+
+  return number;
 }
 
 // using ParseOptionsResult = std::expected<LoadRequestOptions, std::string>;
@@ -989,6 +7398,155 @@ ParseOptionsResult parse_options(int argc, char *argv[]) {
       continue;
     }
 
+    if (arg == "-a" || arg == "--all") {
+      options.run_all = true;
+      continue;
+    }
+
+    if (arg == "--batch") {
+      options.batch = true;
+      continue;
+    }
+
+    if (arg == "-j" || arg == "--parallel") {
+      auto number = it + 1 == args.end()
+                        ? std::nullopt
+                        : parse_positive_number(*(++it));
+
+      if (!number) {
+        return std::unexpected(AgatetepeError{
+            .code = e_agatetepe_error::parse_error,
+            .message = "Error: The " + std::string(arg) +
+                       " option requires a positive number argument."});
+      }
+
+      options.parallel = *number;
+      continue;
+    }
+
+    if (arg == "-n" || arg == "--repeat" || arg == "-c" ||
+        arg == "--concurrency") {
+      auto number = it + 1 == args.end()
+                        ? std::nullopt
+                        : parse_positive_number(*(++it));
+
+      if (!number) {
+        return std::unexpected(AgatetepeError{
+            .code = e_agatetepe_error::parse_error,
+            .message = "Error: The " + std::string(arg) +
+                       " option requires a positive number argument."});
+      }
+
+      (arg == "-n" || arg == "--repeat" ? options.repeat
+                                        : options.concurrency) = *number;
+      continue;
+    }
+
+    if (arg == "--parse-threads") {
+      auto number = it + 1 == args.end()
+                        ? std::nullopt
+                        : parse_positive_number(*(++it));
+
+      if (!number) {
+        return std::unexpected(AgatetepeError{
+            .code = e_agatetepe_error::parse_error,
+            .message = "Error: The " + std::string(arg) +
+                       " option requires a positive number argument."});
+      }
+
+      options.parse_threads = *number;
+      continue;
+    }
+
+    if (arg == "--seed") {
+      uint64_t seed = 0;
+      const std::string_view text = it + 1 == args.end() ? "" : *(++it);
+      const auto [end, error] =
+          std::from_chars(text.data(), text.data() + text.size(), seed);
+
+      if (text.empty() || error != std::errc() ||
+          end != text.data() + text.size()) {
+        return std::unexpected(AgatetepeError{
+            .code = e_agatetepe_error::parse_error,
+            .message = "Error: The " + std::string(arg) +
+                       " option requires a non-negative number argument."});
+      }
+
+      options.seed = seed;
+      continue;
+    }
+
+    if (arg == "--cache") {
+      options.cache_directory = ResponseCache::default_directory();
+      continue;
+    }
+
+    if (arg == "--cache-dir") {
+      if (it + 1 == args.end()) {
+        return std::unexpected(AgatetepeError{
+            .code = e_agatetepe_error::parse_error,
+            .message = "Error: The " + std::string(arg) +
+                       " option requires a directory argument."});
+      }
+      options.cache_directory = std::filesystem::path(*(++it));
+      continue;
+    }
+
+    if (arg == "--parse-cache") {
+      options.parse_cache = true;
+      continue;
+    }
+
+    if (arg == "--watch") {
+      options.watch = true;
+      continue;
+    }
+
+    if (arg == "--watch-check") {
+      options.watch = true;
+      options.check_reparse = true;
+      continue;
+    }
+
+    if (arg == "--warmup") {
+      options.warmup = true;
+      continue;
+    }
+
+    if (arg == "--resolve") {
+      const std::string_view entry = it + 1 == args.end() ? "" : *(++it);
+
+      // host:port:addr, where addr may itself hold colons ([::1], lists)
+      const size_t host_end = entry.find(':');
+      const size_t port_end = host_end == std::string_view::npos
+                                  ? std::string_view::npos
+                                  : entry.find(':', host_end + 1);
+
+      if (host_end == 0 || port_end == std::string_view::npos ||
+          !parse_positive_number(
+              entry.substr(host_end + 1, port_end - host_end - 1)) ||
+          port_end + 1 == entry.size()) {
+        return std::unexpected(AgatetepeError{
+            .code = e_agatetepe_error::parse_error,
+            .message = "Error: The " + std::string(arg) +
+                       " option requires a host:port:addr argument."});
+      }
+
+      options.resolve.emplace_back(entry);
+      continue;
+    }
+
+    if (arg == "--env") {
+      if (it + 1 == args.end()) {
+        return std::unexpected(
+            AgatetepeError{.code = e_agatetepe_error::parse_error,
+                           .message = "Error: The " + std::string(arg) +
+                                      " option requires a name argument."});
+      }
+      options.environment = *(++it);
+      continue;
+    }
+
     if (arg == "-e" || arg == "--eval") {
       if (it + 1 == args.end()) {
         return std::unexpected(
@@ -1053,16 +7611,95 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  HttpRequestApp app;
+  if (options.run_all && options.pick_index.has_value()) {
+    std::println(stderr, "Error: --all and --pick-index are mutually exclusive.");
+    return 1;
+  }
+
+  if (options.parallel.has_value() && !options.run_all && !options.batch) {
+    std::println(stderr, "Error: --parallel requires --all or --batch.");
+    return 1;
+  }
+
+  if (options.batch && options.repeat.has_value()) {
+    std::println(stderr, "Error: --batch and --repeat are mutually exclusive.");
+    return 1;
+  }
+
+  if (options.repeat.has_value() && options.run_all) {
+    std::println(stderr, "Error: --repeat already covers the whole file "
+                         "unless --pick-index is given, drop --all.");
+    return 1;
+  }
+
+  if (options.concurrency.has_value() && !options.repeat.has_value()) {
+    std::println(stderr, "Error: --concurrency requires --repeat.");
+    return 1;
+  }
+
+  if (options.parse_threads.has_value() && options.request_file.empty()) {
+    std::println(stderr, "Error: --parse-threads only applies to <file>.");
+    return 1;
+  }
+
+  if (options.parse_cache && options.request_file.empty()) {
+    std::println(stderr, "Error: --parse-cache only applies to <file>.");
+    return 1;
+  }
+
+  if (options.watch && options.request_file.empty()) {
+    std::println(stderr, "Error: --watch only applies to <file>.");
+    return 1;
+  }
+
+  if (options.watch && (options.parse_cache || options.parse_threads)) {
+    std::println(stderr, "Error: --watch parses the file incrementally, it "
+                         "can't be combined with --parse-cache or "
+                         "--parse-threads.");
+    return 1;
+  }
+
+  if (options.warmup && !options.run_all && !options.batch &&
+      !options.repeat.has_value() && !options.pick_index.has_value()) {
+    std::println(
+        stderr,
+        "Error: --warmup requires --pick-index, --all, --batch or --repeat.");
+    return 1;
+  }
+
+  if (options.seed.has_value()) {
+    DynamicVariableResolver::seed(*options.seed);
+  }
+
+  HttpRequestApp app(options);
   if (!app.load_requests(options)) {
     return 1;
   }
 
-  if (options.pick_index.has_value()) {
-    return app.request_pick_at(options.pick_index.value());
-  } else {
+  if (!options.batch && !options.repeat.has_value() && !options.run_all &&
+      !options.pick_index.has_value()) {
     app.run();
+    return 0;
+  }
+
+  auto run = [&] {
+    if (options.batch) {
+      return app.request_batch(options.pick_index,
+                               options.parallel.value_or(1));
+    } else if (options.repeat.has_value()) {
+      return app.request_load(options.pick_index, options.repeat.value(),
+                              options.concurrency.value_or(1));
+    } else if (options.run_all) {
+      return app.request_all(options.parallel.value_or(1));
+    } else {
+      return app.request_pick_at(options.pick_index.value());
+    }
+  };
+
+  const int exit_code = run();
+  if (options.watch) {
+    app.watch(run);
   }
 
-  return 0;
+  return exit_code;
 }